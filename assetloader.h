@@ -0,0 +1,259 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "object.h"
+#include "utils.h"
+#include "bvh.h"
+
+//Priorities of the assets, by the time they are first needed. Lower values are loaded first.
+const int PRIORITY_FIRST_FRAME = 0;//needed to draw the first frame
+const int PRIORITY_DETAIL = 1;//can pop in during the first frames
+const int PRIORITY_BACKGROUND = 2;//not needed before a while
+
+/* Loads assets in two steps:
+    the CPU work (import, image decoding...) runs on worker threads,
+    the OpenGL work (buffers and textures upload) is queued and run by processUploads on the render thread.
+Jobs are started by priority, then by order of submission.
+*/
+class AssetLoader {
+public:
+    AssetLoader(unsigned int numThreads = std::max(2u, std::thread::hardware_concurrency()) - 1){
+        for(unsigned int i = 0; i < numThreads; i++)
+            workers.push_back(std::thread(&AssetLoader::workerLoop, this));
+    }
+
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+
+    ~AssetLoader(){
+        stop();
+    }
+
+    //wait for the running CPU work and stop the workers, the jobs not started are dropped
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for(std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    //cpuWork runs on a worker thread, then glWork on the thread calling processUploads. Both can be empty.
+    void load(int priority, std::function<void()> cpuWork, std::function<void()> glWork){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Job job = {priority, nextOrder++, cpuWork, glWork};
+            cpuJobs.push(job);
+            pendingJobs[priority]++;
+            totalJobs++;
+        }
+        workAvailable.notify_one();
+    }
+
+    //run the queued OpenGL work on the calling thread until the queue is empty or budgetMs is spent
+    void processUploads(double budgetMs){
+        auto start = std::chrono::steady_clock::now();
+        while(true){
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(glJobs.empty())
+                    return;
+                job = glJobs.top();
+                glJobs.pop();
+            }
+            if(job.glWork)
+                job.glWork();
+            finish(job);
+
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if(elapsed > budgetMs)
+                return;
+        }
+    }
+
+    //true when every job with this priority or a lower one is finished
+    bool isDone(int priority){
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& pending : pendingJobs){
+            if(pending.first <= priority && pending.second > 0)
+                return false;
+        }
+        return true;
+    }
+
+    //between 0 and 1
+    float progress(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return totalJobs == 0 ? 1.0f : (float) finishedJobs / totalJobs;
+    }
+
+private:
+    struct Job {
+        int priority;
+        unsigned long order;
+        std::function<void()> cpuWork;
+        std::function<void()> glWork;
+
+        //std::priority_queue puts the largest element on top
+        bool operator<(const Job& other) const {
+            if(priority != other.priority)
+                return priority > other.priority;
+            return order > other.order;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::priority_queue<Job> cpuJobs;
+    std::priority_queue<Job> glJobs;
+    std::map<int, int> pendingJobs;
+    unsigned long nextOrder = 0;
+    unsigned int totalJobs = 0;
+    unsigned int finishedJobs = 0;
+    bool stopping = false;
+
+    void workerLoop(){
+        while(true){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [this]{ return stopping || !cpuJobs.empty(); });
+                if(stopping)
+                    return;
+                job = cpuJobs.top();
+                cpuJobs.pop();
+            }
+            if(job.cpuWork)
+                job.cpuWork();
+            std::lock_guard<std::mutex> lock(mutex);
+            glJobs.push(job);
+        }
+    }
+
+    void finish(const Job& job){
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingJobs[job.priority]--;
+        finishedJobs++;
+    }
+};
+
+//decode every image of a packed object on the workers and upload them in their layers of the MaterialArrays,
+//the images already added by another object are skipped
+void loadMaterialArraysAsync(AssetLoader& loader, Object* object, int priority){
+    std::set<std::string> queued;
+    for(MaterialPaths& material : object->materialPaths){
+        std::string paths[3] = {material.diffuse, material.normal, material.specular};
+        for(std::string& path : paths){
+            if(path.empty() || !queued.insert(path).second)
+                continue;
+            std::shared_ptr<std::shared_ptr<PendingLayer>> pending = std::make_shared<std::shared_ptr<PendingLayer>>();
+            loader.load(priority, [pending, path]{ *pending = MaterialArrays::instance().prepare(path); },
+                                  [pending]{
+                                      if(*pending)
+                                          MaterialArrays::instance().upload(**pending);
+                                  });
+        }
+    }
+}
+
+//decode every material texture of the object on the workers and upload them one by one
+void loadMaterialsAsync(AssetLoader& loader, Object* object, int priority){
+    if(object->packedMaterials){
+        loadMaterialArraysAsync(loader, object, priority);
+        return;
+    }
+    std::set<Texture*> queued;//materials often share textures
+    for(Material& material : object->materials){
+        std::shared_ptr<Texture> textures[3] = {material.pDiffuse, material.pNormal, material.pSpecularExponent};
+        for(std::shared_ptr<Texture>& texture : textures){
+            if(texture && queued.insert(texture.get()).second)
+                loader.load(priority, [texture]{ texture->decode(); }, [texture]{ texture->upload(GL_TEXTURE0); });
+        }
+    }
+}
+
+//import the object on a worker, upload its buffers with the given priority and its textures with texturePriority
+//with collisions, the BVH of the object moved by collisionModel is built on the worker and added to them
+void loadObjectAsync(AssetLoader& loader, Object* object, const std::string& path, Shader* shader,
+                     VertexFormat format, int priority, int texturePriority, unsigned int loadOptions = OBJECT_LOAD_DEFAULT,
+                     CollisionWorld* collisions = nullptr, const glm::mat4& collisionModel = glm::mat4(1.0f)){
+    std::shared_ptr<TriangleBVH> collider = collisions ? std::make_shared<TriangleBVH>() : nullptr;
+    loader.load(priority,
+        [object, path, loadOptions, collider, collisionModel]{
+            object->load(path.c_str(), loadOptions);
+            object->createMaterials();
+            if(collider)
+                collider->build(*object, collisionModel);
+        },
+        [&loader, object, shader, format, texturePriority, collisions, collider]{
+            object->makeBuffers(*shader, format);
+            loadMaterialsAsync(loader, object, texturePriority);
+            if(collisions)
+                collisions->add(collider);
+        });
+}
+
+//decode the six faces on a worker, the texture name stays 0 until the upload is done (or if a face is invalid)
+void loadCubemapAsync(AssetLoader& loader, GLuint* cubeMapTexture, const std::string& pathToCubeMap, int priority){
+    std::shared_ptr<CubemapFaces> faces = std::make_shared<CubemapFaces>();
+    std::shared_ptr<bool> valid = std::make_shared<bool>(false);
+    loader.load(priority,
+        [faces, valid, pathToCubeMap]{ *valid = decodeCubemapFaces(pathToCubeMap, *faces); },
+        [faces, valid, cubeMapTexture]{
+            if(*valid)
+                uploadCubemap(cubeMapTexture, *faces);
+            else
+                freeCubemapFaces(*faces);
+        });
+}
+
+//compress every texture used by these objects and cubemaps on the workers, see texturecook.h
+void cookAssets(const std::vector<std::string>& objectPaths, const std::vector<std::string>& cubemapPaths){
+    AssetLoader loader;
+    //the role of a texture chooses its format, an image used with several roles keeps the first one
+    std::map<std::string, TextureRole> textures;
+    for(const std::string& path : objectPaths){
+        //only the material paths are read, the mesh cache of the game (with its own load options) is left alone
+        Object object(path.c_str(), OBJECT_LOAD_NO_CACHE);
+        for(MaterialPaths& material : object.materialPaths){
+            std::string paths[3] = {material.diffuse, material.normal, material.specular};
+            TextureRole roles[3] = {TEXTURE_ROLE_COLOR, TEXTURE_ROLE_NORMAL, TEXTURE_ROLE_SPECULAR};
+            for(int i = 0; i < 3; i++){
+                if(!paths[i].empty())
+                    textures.insert(std::make_pair(paths[i], roles[i]));
+            }
+        }
+    }
+
+    for(auto& texture : textures){
+        std::string path = texture.first;
+        TextureRole role = texture.second;
+        loader.load(PRIORITY_FIRST_FRAME, [path, role]{ cookImages({path}, cookedTexturePath(path), true, role); }, nullptr);
+    }
+    for(const std::string& cubemap : cubemapPaths)
+        loader.load(PRIORITY_FIRST_FRAME, [cubemap]{ cookCubemap(cubemap); }, nullptr);
+
+    while(!loader.isDone(PRIORITY_FIRST_FRAME)){
+        loader.processUploads(10.0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <iostream>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "object.h"
+#include "particles.h"
+#include "bvh.h"
+#include "plane.h"
+#include "occlusion.h"
+
+//Benchmarks started from the command line, they run before any window is created
+
+double elapsedMs(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Compare the Assimp import with the mesh cache for every object loaded at startup, with the load options of the game
+//so the timed cache is the one the game reads. The city is streamed by tiles (see worldstream.h) and is not part of it.
+//Only the CPU side is measured, the OpenGL upload done by makeObject is the same for both paths.
+void benchStartup(const std::vector<std::pair<std::string, unsigned int>>& objects, int runs = 3){
+    std::vector<double> importTimes, cacheTimes;
+
+    for(const auto& object : objects){
+        const std::string& path = object.first;
+        unsigned int loadOptions = object.second;
+        double bestImport = 1e30;
+        for(int i = 0; i < runs; i++){
+            auto start = std::chrono::steady_clock::now();
+            Object imported(path.c_str(), loadOptions | OBJECT_LOAD_NO_CACHE);
+            bestImport = std::min(bestImport, elapsedMs(start));
+        }
+
+        //make sure the cache is written before timing it
+        { Object warm(path.c_str(), loadOptions); }
+
+        double bestCache = 1e30;
+        for(int i = 0; i < runs; i++){
+            auto start = std::chrono::steady_clock::now();
+            Object cached(path.c_str(), loadOptions);
+            bestCache = std::min(bestCache, elapsedMs(start));
+        }
+        importTimes.push_back(bestImport);
+        cacheTimes.push_back(bestCache);
+    }
+
+    double totalImport = 0, totalCache = 0;
+    std::cout << std::endl << "Startup benchmark (best of " << runs << " runs)" << std::endl;
+    for(unsigned int i = 0; i < objects.size(); i++){
+        std::cout << objects[i].first << ": assimp " << importTimes[i] << " ms, cache " << cacheTimes[i] << " ms" << std::endl;
+        totalImport += importTimes[i];
+        totalCache += cacheTimes[i];
+    }
+    std::cout << "Total: assimp " << totalImport << " ms, cache " << totalCache << " ms" << std::endl;
+}
+
+//fill a pool with count particles flying in random directions, long lived so none dies during the benchmark
+void fillParticlePool(ParticlePool& pool, size_t count){
+    unsigned int seed = 12345;
+    auto random = [&seed](){
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 8388608.0f - 1.0f;//[-1, 1)
+    };
+    for(size_t i = 0; i < count; i++){
+        glm::vec3 direction(random(), random(), random());
+        if(glm::length(direction) < 1e-3f)
+            direction = glm::vec3(1.0f, 0.0f, 0.0f);
+        pool.add(glm::normalize(direction), glm::vec3(random(), random(), random()) * 100.0f, glm::mat3(1.0f), 1e6f);
+    }
+}
+
+//Time one update of the particle simulation for every kernel, then with the best kernel on every core.
+void benchParticles(){
+    const float deltaTime = 1.0f / 60.0f;
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    //every kernel must give the scalar result
+    ParticlePool reference(1003);
+    fillParticlePool(reference, 1003);
+    reference.integrate(deltaTime, PARTICLE_SPEED, PARTICLE_KERNEL_SCALAR);
+    for(int k = PARTICLE_KERNEL_SSE; k < NUM_PARTICLE_KERNELS; k++){
+        ParticleKernel kernel = (ParticleKernel) k;
+        if(!isParticleKernelSupported(kernel))
+            continue;
+        ParticlePool candidate(1003);
+        fillParticlePool(candidate, 1003);
+        candidate.integrate(deltaTime, PARTICLE_SPEED, kernel);
+        bool same = candidate.positionX == reference.positionX && candidate.positionY == reference.positionY
+                 && candidate.positionZ == reference.positionZ && candidate.life == reference.life;
+        if(!same)
+            std::cout << "Particle kernel " << particleKernelName(kernel) << " does not match the scalar kernel" << std::endl;
+    }
+
+    std::cout << std::endl << "Particle update benchmark (ms per update, best of 5 runs), best kernel: "
+              << particleKernelName(bestParticleKernel()) << ", " << cores << " threads" << std::endl;
+    for(size_t count : {(size_t) 1000, (size_t) 100000, (size_t) 1000000}){
+        ParticlePool pool(count);
+        fillParticlePool(pool, count);
+        //about 20 million particles per run
+        int updates = std::max<int>(10, 20000000 / count);
+
+        auto measure = [&](ParticleKernel kernel, unsigned int threads){
+            double best = 1e30;
+            for(int run = 0; run < 5; run++){
+                auto start = std::chrono::steady_clock::now();
+                for(int i = 0; i < updates; i++){
+                    pool.removeDead(deltaTime);
+                    pool.integrate(deltaTime, PARTICLE_SPEED, kernel, threads);
+                }
+                best = std::min(best, elapsedMs(start) / updates);
+            }
+            return best;
+        };
+
+        std::cout << count << " particles:";
+        for(int k = 0; k < NUM_PARTICLE_KERNELS; k++){
+            ParticleKernel kernel = (ParticleKernel) k;
+            if(isParticleKernelSupported(kernel))
+                std::cout << " " << particleKernelName(kernel) << " " << measure(kernel, 1) << " ms,";
+        }
+        std::cout << " " << particleKernelName(bestParticleKernel()) << " x" << cores << " threads "
+                  << measure(bestParticleKernel(), cores) << " ms" << std::endl;
+    }
+}
+
+//random segments in the bounds, in groups of 8 close to each other like the lasers of one plane
+void makeBenchRays(std::vector<BVHRay>& rays, size_t count, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float length){
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f), jitter(-1.0f, 1.0f);
+    rays.resize(count);
+    glm::vec3 origin, direction;
+    for(size_t i = 0; i < count; i++){
+        if(i % 8 == 0){
+            origin = boundsMin + (boundsMax - boundsMin) * glm::vec3(unit(random), unit(random), unit(random));
+            direction = glm::normalize(glm::vec3(jitter(random), jitter(random), jitter(random)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+        }
+        rays[i].origin = origin + glm::vec3(jitter(random), jitter(random), jitter(random));
+        rays[i].direction = glm::normalize(direction + 0.01f * glm::vec3(jitter(random), jitter(random), jitter(random))) * length;
+        rays[i].maxDistance = 1.0f;
+    }
+}
+
+//BVH build and queries on the triangles of the object, checked against a loop over every triangle
+void benchCollisions(const std::string& path){
+    Object object(path.c_str());
+    if(object.meshes.empty()){
+        std::cout << "Can not load " << path << std::endl;
+        return;
+    }
+
+    TriangleBVH bvh;
+    double bestBuild = 1e30;
+    for(int run = 0; run < 3; run++){
+        auto start = std::chrono::steady_clock::now();
+        bvh.build(object, glm::mat4(1.0f));
+        bestBuild = std::min(bestBuild, elapsedMs(start));
+    }
+    std::vector<TriangleBVH::Triangle> triangles;
+    for(const Object::BasicMeshEntry& mesh : object.meshes){
+        for(unsigned int i = 0; i + 2 < mesh.numIndices; i += 3){
+            const unsigned int* index = &object.indices[mesh.baseIndex + i];
+            glm::vec3 v0 = object.positions[mesh.baseVertex + index[0]];
+            triangles.push_back({v0, object.positions[mesh.baseVertex + index[1]] - v0, object.positions[mesh.baseVertex + index[2]] - v0});
+        }
+    }
+    glm::vec3 boundsMin = bvh.root().boundsMin, boundsMax = bvh.root().boundsMax;
+    std::cout << std::endl << "Collision benchmark, " << path << ": " << triangles.size() << " triangles, BVH built in "
+              << bestBuild << " ms, " << bvh.memoryBytes() / 1024 << " KB" << std::endl;
+
+    //rays across the whole object, the brute force loop gives the reference
+    std::vector<BVHRay> rays;
+    makeBenchRays(rays, 2000, boundsMin, boundsMax, glm::length(boundsMax - boundsMin));
+    std::vector<BVHHit> single(rays.size()), packets(rays.size());
+    size_t mismatches = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> reference(rays.size(), std::numeric_limits<float>::infinity());
+    for(size_t i = 0; i < rays.size(); i++){
+        for(const TriangleBVH::Triangle& triangle : triangles){
+            float t;
+            if(TriangleBVH::intersectTriangle(triangle, rays[i].origin, rays[i].direction, std::min(rays[i].maxDistance, reference[i]), t))
+                reference[i] = t;
+        }
+    }
+    double bruteMs = elapsedMs(start);
+    for(size_t i = 0; i < rays.size(); i++)
+        bvh.intersectRay(rays[i], single[i]);
+    bvh.intersectRays(rays.data(), rays.size(), packets.data());
+    for(size_t i = 0; i < rays.size(); i++){
+        if(single[i].distance != reference[i] || packets[i].distance != reference[i])
+            mismatches++;
+    }
+    std::cout << "Brute force: " << bruteMs * 1000.0 / rays.size() << " us per ray, " << mismatches << " BVH results differ" << std::endl;
+
+    auto measure = [&](const std::vector<BVHRay>& queries, bool usePackets){
+        std::vector<BVHHit> hits(queries.size());
+        double best = 1e30;
+        for(int run = 0; run < 3; run++){
+            std::fill(hits.begin(), hits.end(), BVHHit());
+            auto start = std::chrono::steady_clock::now();
+            if(usePackets){
+                bvh.intersectRays(queries.data(), queries.size(), hits.data());
+            }else{
+                for(size_t i = 0; i < queries.size(); i++)
+                    bvh.intersectRay(queries[i], hits[i]);
+            }
+            best = std::min(best, elapsedMs(start));
+        }
+        return best;
+    };
+    //lasers move PARTICLE_SPEED / 60 per frame, long rays cross the object
+    for(int kind = 0; kind < 2; kind++){
+        size_t count = kind == 0 ? 1000000 : 100000;
+        makeBenchRays(rays, count, boundsMin, boundsMax, kind == 0 ? PARTICLE_SPEED / 60.0f : glm::length(boundsMax - boundsMin));
+        std::cout << count << (kind == 0 ? " laser segments" : " long rays") << ": single " << measure(rays, false)
+                  << " ms, packets of 4 " << measure(rays, true) << " ms" << std::endl;
+    }
+
+    //plane moves
+    makeBenchRays(rays, 100000, boundsMin, boundsMax, PLANE_SPEED);
+    start = std::chrono::steady_clock::now();
+    size_t contacts = 0;
+    for(const BVHRay& ray : rays){
+        BVHHit hit;
+        contacts += bvh.sweepSphere(ray.origin, ray.origin + ray.direction, PLANE_COLLISION_RADIUS, hit);
+    }
+    std::cout << rays.size() << " swept spheres: " << elapsedMs(start) << " ms, " << contacts << " contacts" << std::endl;
+}
+
+//box of the occlusion self-test, true when isVisible gives the expected answer
+bool checkOcclusion(const OcclusionBuffer& occlusion, const glm::mat4& viewProjection, const char* name,
+                    const glm::vec3& boundsMin, const glm::vec3& boundsMax, bool expectedVisible){
+    bool visible = occlusion.isVisible(viewProjection, boundsMin, boundsMax);
+    std::cout << name << ": " << (visible ? "visible" : "hidden") << (visible == expectedVisible ? "" : ", FAILED") << std::endl;
+    return visible == expectedVisible;
+}
+
+//Check the software occlusion culling without OpenGL on a known scene, then compare the threaded rasterization
+//with the single threaded one and time both on many random occluders.
+bool benchOcclusion(){
+    //camera at the origin looking down -z, the buffer is twice as wide as high
+    glm::mat4 viewProjection = glm::perspective(glm::radians(90.0f), 2.0f, 0.1f, 1000.0f);
+    //a 10 x 10 wall 10 units in front of the camera, two triangles
+    std::vector<glm::vec3> wall = {glm::vec3(-5.0f, -5.0f, -10.0f), glm::vec3(5.0f, -5.0f, -10.0f),
+                                   glm::vec3(5.0f, 5.0f, -10.0f), glm::vec3(-5.0f, 5.0f, -10.0f)};
+    std::vector<unsigned int> wallIndices = {0, 1, 2, 0, 2, 3};
+
+    OcclusionBuffer occlusion;
+    occlusion.begin(viewProjection);
+    occlusion.addOccluder(wall.data(), wallIndices.data(), wallIndices.size(), 0, glm::mat4(1.0f), 1.0f);
+    occlusion.rasterize();
+
+    std::cout << std::endl << "Occlusion self-test" << std::endl;
+    bool passed = true;
+    passed &= checkOcclusion(occlusion, viewProjection, "Box behind the wall", glm::vec3(-1.0f, -1.0f, -22.0f), glm::vec3(1.0f, 1.0f, -20.0f), false);
+    passed &= checkOcclusion(occlusion, viewProjection, "Box beside the wall", glm::vec3(14.0f, -1.0f, -22.0f), glm::vec3(16.0f, 1.0f, -20.0f), true);
+    passed &= checkOcclusion(occlusion, viewProjection, "Box in front of the wall", glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -4.0f), true);
+    passed &= checkOcclusion(occlusion, viewProjection, "Box across the near plane", glm::vec3(-1.0f, -1.0f, -2.0f), glm::vec3(1.0f, 1.0f, 1.0f), true);
+    passed &= checkOcclusion(occlusion, viewProjection, "Box across the wall", glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 1.0f, -8.0f), true);
+
+    //random triangles in front of the camera, the bands of the threads must give the single threaded buffer
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    for(unsigned int i = 0; i < OCCLUSION_MAX_TRIANGLES; i++){
+        glm::vec3 center(unit(random) * 40.0f, unit(random) * 20.0f, -30.0f + unit(random) * 25.0f);
+        for(int v = 0; v < 3; v++){
+            indices.push_back(positions.size());
+            positions.push_back(center + glm::vec3(unit(random), unit(random), unit(random)) * 3.0f);
+        }
+    }
+    //the threads of the game, at least two to check the workers
+    unsigned int threads = std::min(4u, std::max(2u, std::thread::hardware_concurrency()));
+    OcclusionBuffer threaded;
+    auto measure = [&](OcclusionBuffer& buffer, unsigned int maxThreads){
+        double best = 1e30;
+        for(int run = 0; run < 5; run++){
+            auto start = std::chrono::steady_clock::now();
+            for(int frame = 0; frame < 20; frame++){
+                buffer.begin(viewProjection);
+                buffer.addOccluder(positions.data(), indices.data(), indices.size(), 0, glm::mat4(1.0f), 1.0f);
+                buffer.rasterize(maxThreads);
+            }
+            best = std::min(best, elapsedMs(start) / 20);
+        }
+        return best;
+    };
+    double singleMs = measure(occlusion, 1);
+    double threadedMs = measure(threaded, threads);
+    bool same = occlusion.depthBuffer() == threaded.depthBuffer();
+    passed &= same;
+    std::cout << "Threaded depth " << (same ? "matches" : "differs from, FAILED,") << " the single threaded one" << std::endl;
+    std::cout << occlusion.triangleCount() << " occluder triangles: 1 thread " << singleMs << " ms, "
+              << threads << " threads " << threadedMs << " ms" << std::endl;
+    std::cout << (passed ? "Occlusion self-test passed" : "Occlusion self-test FAILED") << std::endl;
+    return passed;
+}
+
+#endif
@@ -0,0 +1,660 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <glm/glm.hpp>
+
+#include "object.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE
+#include <emmintrin.h>
+#endif
+
+/* Bounding volume hierarchy over the triangles of static objects, in world space, for the collisions.
+It is built with the surface area heuristic: every node is split where the sum of (area * triangles) of its
+two children is the lowest, among BVH_BINS positions on each axis. The triangles are copied in the order of
+the leaves. Queries return the closest hit: rays, segments and spheres moving along a segment.
+intersectRays takes many rays, 4 of them go down the tree together with SSE (packet traversal):
+lasers fired by the same plane are close to each other, so they mostly visit the same nodes.
+*/
+#define BVH_BINS 12
+#define BVH_MAX_LEAF_TRIANGLES 4 //smaller nodes are never split
+#define BVH_MAX_LEAF_SAH 16 //larger nodes are always split, even when the heuristic says a leaf is cheaper
+#define BVH_STACK_SIZE 64 //the depth of the tree is limited to this
+#define BVH_NO_HIT 0xFFFFFFFFu
+
+//a segment from a to b is the ray of origin a, direction b - a and maxDistance 1
+struct BVHRay {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float maxDistance;
+};
+
+//a query only writes a hit closer than the one already there, so a hit can be narrowed by several BVH
+struct BVHHit {
+    float distance = std::numeric_limits<float>::infinity();//in lengths of the ray direction
+    glm::vec3 normal = glm::vec3(0.0f);//unit, facing the ray or the sphere
+    uint32_t triangle = BVH_NO_HIT;//index of the triangle in the order given to build
+    bool hit() const {
+        return triangle != BVH_NO_HIT;
+    }
+};
+
+class TriangleBVH {
+public:
+    struct Node {
+        glm::vec3 boundsMin;
+        uint32_t first;//inner node: left child, the right child is next. leaf: first triangle
+        glm::vec3 boundsMax;
+        uint32_t count;//triangles of a leaf, 0 for an inner node
+    };
+
+    struct Triangle {
+        glm::vec3 v0;
+        glm::vec3 edge1;//v1 - v0
+        glm::vec3 edge2;//v2 - v0
+    };
+
+    //the full meshes of the object (not the LOD levels) moved by model
+    void build(const Object& object, const glm::mat4& model){
+        std::vector<Triangle> input;
+        input.reserve(object.indices.size() / 3);
+        for(const Object::BasicMeshEntry& mesh : object.meshes){
+            for(unsigned int i = 0; i + 2 < mesh.numIndices; i += 3){
+                const unsigned int* index = &object.indices[mesh.baseIndex + i];
+                glm::vec3 v0 = glm::vec3(model * glm::vec4(object.positions[mesh.baseVertex + index[0]], 1.0f));
+                glm::vec3 v1 = glm::vec3(model * glm::vec4(object.positions[mesh.baseVertex + index[1]], 1.0f));
+                glm::vec3 v2 = glm::vec3(model * glm::vec4(object.positions[mesh.baseVertex + index[2]], 1.0f));
+                input.push_back({v0, v1 - v0, v2 - v0});
+            }
+        }
+        build(input);
+    }
+
+    void build(const std::vector<Triangle>& input){
+        nodes.clear();
+        triangles.clear();
+        triangleIds.resize(input.size());
+        std::iota(triangleIds.begin(), triangleIds.end(), 0);
+        if(input.empty())
+            return;
+
+        std::vector<glm::vec3> boundsMin(input.size()), boundsMax(input.size()), centroids(input.size());
+        for(size_t i = 0; i < input.size(); i++){
+            const Triangle& triangle = input[i];
+            glm::vec3 v1 = triangle.v0 + triangle.edge1, v2 = triangle.v0 + triangle.edge2;
+            boundsMin[i] = glm::min(triangle.v0, glm::min(v1, v2));
+            boundsMax[i] = glm::max(triangle.v0, glm::max(v1, v2));
+            centroids[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+        }
+
+        //a binary tree with leaves of at least one triangle has less than 2n nodes, the references stay valid
+        nodes.reserve(2 * input.size());
+        nodes.push_back(Node());
+        nodes[0].first = 0;
+        nodes[0].count = input.size();
+        subdivide(0, 0, boundsMin, boundsMax, centroids);
+
+        triangles.resize(input.size());
+        for(size_t i = 0; i < input.size(); i++)
+            triangles[i] = input[triangleIds[i]];
+        nodes.shrink_to_fit();
+    }
+
+    bool empty() const {
+        return triangles.empty();
+    }
+
+    const Node& root() const {
+        return nodes[0];
+    }
+
+    //bytes of the tree and of its triangles
+    size_t memoryBytes() const {
+        return nodes.size() * sizeof(Node) + triangles.size() * (sizeof(Triangle) + sizeof(uint32_t));
+    }
+
+    //closest hit of the ray, true if hit was narrowed
+    bool intersectRay(const BVHRay& ray, BVHHit& hit) const {
+        if(empty())
+            return false;
+        float maxDistance = std::min(ray.maxDistance, hit.distance);
+        glm::vec3 inverseDirection = safeInverse(ray.direction);
+        uint32_t found = BVH_NO_HIT;
+        traverse(ray.origin, inverseDirection, 0.0f, maxDistance, [&](uint32_t first, uint32_t count){
+            for(uint32_t i = first; i < first + count; i++){
+                float t;
+                if(intersectTriangle(triangles[i], ray.origin, ray.direction, maxDistance, t)){
+                    maxDistance = t;
+                    found = i;
+                }
+            }
+        });
+        if(found == BVH_NO_HIT)
+            return false;
+        writeHit(hit, found, maxDistance, ray.direction);
+        return true;
+    }
+
+    bool intersectSegment(const glm::vec3& from, const glm::vec3& to, BVHHit& hit) const {
+        return intersectRay({from, to - from, 1.0f}, hit);
+    }
+
+    //every ray against the tree, hits[i] is narrowed like by intersectRay(rays[i], hits[i])
+    void intersectRays(const BVHRay* rays, size_t count, BVHHit* hits) const {
+        if(empty())
+            return;
+#ifdef BVH_SSE
+        for(size_t i = 0; i < count; i += 4)
+            intersectPacket(rays + i, hits + i, std::min<size_t>(4, count - i));
+#else
+        for(size_t i = 0; i < count; i++)
+            intersectRay(rays[i], hits[i]);
+#endif
+    }
+
+    //first contact of a sphere moving from "from" to "to", hit.distance is in [0, 1] along the move.
+    //a sphere already touching a triangle only hits it when it moves closer to it
+    bool sweepSphere(const glm::vec3& from, const glm::vec3& to, float radius, BVHHit& hit) const {
+        if(empty())
+            return false;
+        glm::vec3 move = to - from;
+        float maxDistance = std::min(1.0f, hit.distance);
+        glm::vec3 normal;
+        uint32_t found = BVH_NO_HIT;
+        traverse(from, safeInverse(move), radius, maxDistance, [&](uint32_t first, uint32_t count){
+            for(uint32_t i = first; i < first + count; i++){
+                float t;
+                glm::vec3 contactNormal;
+                if(sweepSphereTriangle(triangles[i], from, move, radius, maxDistance, t, contactNormal)){
+                    maxDistance = t;
+                    normal = contactNormal;
+                    found = i;
+                }
+            }
+        });
+        if(found == BVH_NO_HIT)
+            return false;
+        hit.distance = maxDistance;
+        hit.normal = normal;
+        hit.triangle = triangleIds[found];
+        return true;
+    }
+
+    //Moller-Trumbore, both faces, a hit must be closer than maxDistance
+    static bool intersectTriangle(const Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& t){
+        glm::vec3 p = glm::cross(direction, triangle.edge2);
+        float det = glm::dot(triangle.edge1, p);
+        if(det == 0.0f)
+            return false;
+        float inverseDet = 1.0f / det;
+        glm::vec3 s = origin - triangle.v0;
+        float u = glm::dot(s, p) * inverseDet;
+        if(u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, triangle.edge1);
+        float v = glm::dot(direction, q) * inverseDet;
+        if(v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(triangle.edge2, q) * inverseDet;
+        return t >= 0.0f && t < maxDistance;
+    }
+
+private:
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;//in the order of the leaves
+    std::vector<uint32_t> triangleIds;//index given to build of every triangle
+
+    static float halfArea(const glm::vec3& extent){
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    //no infinite inverse, it would give NaN for an origin on a slab of a box
+    static glm::vec3 safeInverse(const glm::vec3& direction){
+        glm::vec3 inverse;
+        for(int axis = 0; axis < 3; axis++)
+            inverse[axis] = 1.0f / (std::fabs(direction[axis]) > 1e-20f ? direction[axis] : std::copysign(1e-20f, direction[axis]));
+        return inverse;
+    }
+
+    void subdivide(uint32_t nodeIndex, int depth, const std::vector<glm::vec3>& boundsMin,
+                   const std::vector<glm::vec3>& boundsMax, const std::vector<glm::vec3>& centroids){
+        Node& node = nodes[nodeIndex];
+        uint32_t first = node.first, count = node.count;
+        node.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+        node.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+        glm::vec3 centroidMin = node.boundsMin, centroidMax = node.boundsMax;
+        for(uint32_t i = first; i < first + count; i++){
+            uint32_t id = triangleIds[i];
+            node.boundsMin = glm::min(node.boundsMin, boundsMin[id]);
+            node.boundsMax = glm::max(node.boundsMax, boundsMax[id]);
+            centroidMin = glm::min(centroidMin, centroids[id]);
+            centroidMax = glm::max(centroidMax, centroids[id]);
+        }
+        if(count <= BVH_MAX_LEAF_TRIANGLES || depth >= BVH_STACK_SIZE - 1)
+            return;
+
+        //binned SAH: cost of every split between two bins, on every axis
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        for(int axis = 0; axis < 3; axis++){
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if(extent <= 0.0f)
+                continue;
+            float scale = BVH_BINS / extent;
+            glm::vec3 binMin[BVH_BINS], binMax[BVH_BINS];
+            uint32_t binCount[BVH_BINS] = {0};
+            for(int b = 0; b < BVH_BINS; b++){
+                binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+                binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+            }
+            for(uint32_t i = first; i < first + count; i++){
+                uint32_t id = triangleIds[i];
+                int b = std::min(BVH_BINS - 1, (int) ((centroids[id][axis] - centroidMin[axis]) * scale));
+                binCount[b]++;
+                binMin[b] = glm::min(binMin[b], boundsMin[id]);
+                binMax[b] = glm::max(binMax[b], boundsMax[id]);
+            }
+            //areas of the bins left of each split, then right of it
+            float leftArea[BVH_BINS - 1];
+            uint32_t leftCount[BVH_BINS - 1];
+            glm::vec3 sweepMin = glm::vec3(std::numeric_limits<float>::max()), sweepMax = -sweepMin;
+            uint32_t sweepCount = 0;
+            for(int b = 0; b < BVH_BINS - 1; b++){
+                sweepCount += binCount[b];
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                leftCount[b] = sweepCount;
+                leftArea[b] = sweepCount ? halfArea(sweepMax - sweepMin) : 0.0f;
+            }
+            sweepMin = glm::vec3(std::numeric_limits<float>::max());
+            sweepMax = -sweepMin;
+            sweepCount = 0;
+            for(int b = BVH_BINS - 1; b > 0; b--){
+                sweepCount += binCount[b];
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                if(!sweepCount || !leftCount[b - 1])
+                    continue;
+                float cost = leftArea[b - 1] * leftCount[b - 1] + halfArea(sweepMax - sweepMin) * sweepCount;
+                if(cost < bestCost){
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+        //all the centroids at the same place, or a leaf costs less than the split
+        if(bestAxis < 0 || (count <= BVH_MAX_LEAF_SAH && bestCost >= halfArea(node.boundsMax - node.boundsMin) * count))
+            return;
+
+        float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        uint32_t* middle = std::partition(&triangleIds[first], &triangleIds[first] + count, [&](uint32_t id){
+            return std::min(BVH_BINS - 1, (int) ((centroids[id][bestAxis] - centroidMin[bestAxis]) * scale)) < bestSplit;
+        });
+        uint32_t leftCount = middle - &triangleIds[first];
+
+        uint32_t left = nodes.size();
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[left].first = first;
+        nodes[left].count = leftCount;
+        nodes[left + 1].first = first + leftCount;
+        nodes[left + 1].count = count - leftCount;
+        node.first = left;
+        node.count = 0;
+        subdivide(left, depth + 1, boundsMin, boundsMax, centroids);
+        subdivide(left + 1, depth + 1, boundsMin, boundsMax, centroids);
+    }
+
+    //slab test of the box grown by expand, entry is where the ray enters it
+    static bool intersectBox(const Node& node, const glm::vec3& origin, const glm::vec3& inverseDirection,
+                             float expand, float maxDistance, float& entry){
+        glm::vec3 t1 = (node.boundsMin - expand - origin) * inverseDirection;
+        glm::vec3 t2 = (node.boundsMax + expand - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t1, t2), tFar = glm::max(t1, t2);
+        entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        return entry <= exit;
+    }
+
+    //calls leaf(first, count) for every leaf the ray goes through, the closest child first.
+    //maxDistance is read again after every leaf, so the leaves farther than the closest hit are skipped
+    template<typename LeafFunction>
+    void traverse(const glm::vec3& origin, const glm::vec3& inverseDirection, float expand, const float& maxDistance, LeafFunction leaf) const {
+        struct Entry {
+            uint32_t node;
+            float distance;
+        };
+        Entry stack[BVH_STACK_SIZE];
+        int size = 0;
+        float entry;
+        if(!intersectBox(nodes[0], origin, inverseDirection, expand, maxDistance, entry))
+            return;
+        stack[size++] = {0, entry};
+        while(size){
+            Entry current = stack[--size];
+            if(current.distance > maxDistance)
+                continue;
+            const Node& node = nodes[current.node];
+            if(node.count){
+                leaf(node.first, node.count);
+                continue;
+            }
+            float leftEntry, rightEntry;
+            bool hitLeft = intersectBox(nodes[node.first], origin, inverseDirection, expand, maxDistance, leftEntry);
+            bool hitRight = intersectBox(nodes[node.first + 1], origin, inverseDirection, expand, maxDistance, rightEntry);
+            //the far child is pushed first
+            if(hitLeft && hitRight && leftEntry < rightEntry){
+                stack[size++] = {node.first + 1, rightEntry};
+                stack[size++] = {node.first, leftEntry};
+            }else{
+                if(hitLeft)
+                    stack[size++] = {node.first, leftEntry};
+                if(hitRight)
+                    stack[size++] = {node.first + 1, rightEntry};
+            }
+        }
+    }
+
+    void writeHit(BVHHit& hit, uint32_t triangle, float distance, const glm::vec3& direction) const {
+        const Triangle& t = triangles[triangle];
+        glm::vec3 normal = glm::cross(t.edge1, t.edge2);
+        float length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : -direction;
+        if(glm::dot(normal, direction) > 0.0f)
+            normal = -normal;
+        hit.distance = distance;
+        hit.normal = normal;
+        hit.triangle = triangleIds[triangle];
+    }
+
+    //closest point of the triangle to p, from Real-Time Collision Detection (Ericson) 5.1.5
+    static glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c){
+        glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+        float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+        if(d1 <= 0.0f && d2 <= 0.0f)
+            return a;
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+        if(d3 >= 0.0f && d4 <= d3)
+            return b;
+        float vc = d1 * d4 - d3 * d2;
+        if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            return a + ab * (d1 / (d1 - d3));
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        if(d6 >= 0.0f && d5 <= d6)
+            return c;
+        float vb = d5 * d2 - d1 * d6;
+        if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            return a + ac * (d2 / (d2 - d6));
+        float va = d3 * d6 - d5 * d4;
+        if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        float denom = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denom) + ac * (vc * denom);
+    }
+
+    //first t in [0, best) where the ray is at distance radius of the point, the ray starts outside of the sphere
+    static bool sweepSpherePoint(const glm::vec3& center, const glm::vec3& move, float radius, const glm::vec3& point, float& best){
+        glm::vec3 m = center - point;
+        float a = glm::dot(move, move), b = glm::dot(m, move), c = glm::dot(m, m) - radius * radius;
+        float discriminant = b * b - a * c;
+        if(a == 0.0f || b >= 0.0f || discriminant < 0.0f)
+            return false;
+        float t = (-b - std::sqrt(discriminant)) / a;
+        if(t < 0.0f || t >= best)
+            return false;
+        best = t;
+        return true;
+    }
+
+    //same against the cylinder around the edge [p, q], its ends are handled by sweepSpherePoint
+    static bool sweepSphereEdge(const glm::vec3& center, const glm::vec3& move, float radius, const glm::vec3& p, const glm::vec3& q, float& best){
+        glm::vec3 edge = q - p, m = center - p;
+        float ee = glm::dot(edge, edge), ed = glm::dot(edge, move), em = glm::dot(edge, m);
+        float a = ee * glm::dot(move, move) - ed * ed;
+        float b = ee * glm::dot(m, move) - em * ed;
+        float c = ee * (glm::dot(m, m) - radius * radius) - em * em;
+        float discriminant = b * b - a * c;
+        //moving along the edge never enters the cylinder from its side
+        if(a <= 1e-12f * ee * glm::dot(move, move) || b >= 0.0f || discriminant < 0.0f)
+            return false;
+        float t = (-b - std::sqrt(discriminant)) / a;
+        if(t < 0.0f || t >= best)
+            return false;
+        float s = (em + t * ed) / ee;
+        if(s < 0.0f || s > 1.0f)
+            return false;
+        best = t;
+        return true;
+    }
+
+    //first contact of the moving sphere with the face, the edges or the corners of the triangle
+    static bool sweepSphereTriangle(const Triangle& triangle, const glm::vec3& center, const glm::vec3& move, float radius,
+                                    float maxDistance, float& t, glm::vec3& normal){
+        glm::vec3 v0 = triangle.v0, v1 = v0 + triangle.edge1, v2 = v0 + triangle.edge2;
+        glm::vec3 faceNormal = glm::cross(triangle.edge1, triangle.edge2);
+        float faceLength = glm::length(faceNormal);
+        faceNormal = faceLength > 0.0f ? faceNormal / faceLength : glm::vec3(0.0f);
+
+        glm::vec3 offset = center - closestPointOnTriangle(center, v0, v1, v2);
+        float distance2 = glm::dot(offset, offset);
+        if(distance2 <= radius * radius){
+            glm::vec3 away = distance2 > 0.0f ? offset / std::sqrt(distance2) : (glm::dot(faceNormal, move) > 0.0f ? -faceNormal : faceNormal);
+            if(glm::dot(away, move) >= 0.0f)
+                return false;
+            t = 0.0f;
+            normal = away;
+            return true;
+        }
+
+        float best = maxDistance;
+        bool found = false;
+        if(faceLength > 0.0f){
+            //normal of the face on the side of the sphere
+            glm::vec3 n = glm::dot(center - v0, faceNormal) < 0.0f ? -faceNormal : faceNormal;
+            float side = glm::dot(center - v0, n), speed = glm::dot(move, n);
+            if(speed < 0.0f && side >= radius){
+                float tFace = (radius - side) / speed;
+                //the point of the sphere touching the plane must be inside the triangle
+                glm::vec3 contact = center + move * tFace - n * radius;
+                glm::vec3 inside = contact - closestPointOnTriangle(contact, v0, v1, v2);
+                if(tFace < best && glm::dot(inside, inside) <= 1e-6f * radius * radius){
+                    best = tFace;
+                    found = true;
+                }
+            }
+        }
+        found |= sweepSphereEdge(center, move, radius, v0, v1, best);
+        found |= sweepSphereEdge(center, move, radius, v1, v2, best);
+        found |= sweepSphereEdge(center, move, radius, v2, v0, best);
+        found |= sweepSpherePoint(center, move, radius, v0, best);
+        found |= sweepSpherePoint(center, move, radius, v1, best);
+        found |= sweepSpherePoint(center, move, radius, v2, best);
+        if(!found)
+            return false;
+
+        glm::vec3 centerAtContact = center + move * best;
+        glm::vec3 contactOffset = centerAtContact - closestPointOnTriangle(centerAtContact, v0, v1, v2);
+        float contactLength = glm::length(contactOffset);
+        normal = contactLength > 0.0f ? contactOffset / contactLength : -glm::normalize(move);
+        t = best;
+        return true;
+    }
+
+#ifdef BVH_SSE
+    //4 rays down the tree together, the inactive lanes have a negative maxDistance and never hit
+    void intersectPacket(const BVHRay* rays, BVHHit* hits, size_t count) const {
+        alignas(16) float origin[3][4], direction[3][4], inverse[3][4], closest[4];
+        for(size_t k = 0; k < 4; k++){
+            const BVHRay& ray = rays[k < count ? k : 0];
+            glm::vec3 inverseDirection = safeInverse(ray.direction);
+            for(int axis = 0; axis < 3; axis++){
+                origin[axis][k] = ray.origin[axis];
+                direction[axis][k] = ray.direction[axis];
+                inverse[axis][k] = inverseDirection[axis];
+            }
+            closest[k] = k < count ? std::min(ray.maxDistance, hits[k].distance) : -1.0f;
+        }
+        __m128 ox = _mm_load_ps(origin[0]), oy = _mm_load_ps(origin[1]), oz = _mm_load_ps(origin[2]);
+        __m128 dx = _mm_load_ps(direction[0]), dy = _mm_load_ps(direction[1]), dz = _mm_load_ps(direction[2]);
+        __m128 ix = _mm_load_ps(inverse[0]), iy = _mm_load_ps(inverse[1]), iz = _mm_load_ps(inverse[2]);
+        __m128 tMax = _mm_load_ps(closest);
+        __m128i found = _mm_set1_epi32(-1);//BVH_NO_HIT
+
+        //entry of every active lane in the node, +infinity for the others, returns the mask of the active lanes
+        auto intersectBox4 = [&](const Node& node, __m128& entry){
+            __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), ox), ix);
+            __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), ox), ix);
+            __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), oy), iy);
+            __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), oy), iy);
+            __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), oz), iz);
+            __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), oz), iz);
+            __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_max_ps(_mm_min_ps(t1z, t2z), _mm_setzero_ps()));
+            __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_min_ps(_mm_max_ps(t1z, t2z), tMax));
+            __m128 hit = _mm_cmple_ps(tNear, tFar);
+            entry = _mm_or_ps(_mm_and_ps(hit, tNear), _mm_andnot_ps(hit, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+            return _mm_movemask_ps(hit);
+        };
+        auto minLane = [](__m128 v){
+            v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+            v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+            return _mm_cvtss_f32(v);
+        };
+
+        uint32_t stack[BVH_STACK_SIZE];
+        int size = 0;
+        stack[size++] = 0;
+        __m128 entry, leftEntry, rightEntry;
+        while(size){
+            const Node& node = nodes[stack[--size]];
+            //tested when pushed, again now that the closest hits may be nearer
+            if(!intersectBox4(node, entry))
+                continue;
+            if(node.count){
+                for(uint32_t i = node.first; i < node.first + node.count; i++){
+                    const Triangle& triangle = triangles[i];
+                    __m128 e1x = _mm_set1_ps(triangle.edge1.x), e1y = _mm_set1_ps(triangle.edge1.y), e1z = _mm_set1_ps(triangle.edge1.z);
+                    __m128 e2x = _mm_set1_ps(triangle.edge2.x), e2y = _mm_set1_ps(triangle.edge2.y), e2z = _mm_set1_ps(triangle.edge2.z);
+                    //same operations as intersectTriangle, lane by lane
+                    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+                    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+                    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+                    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+                    __m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+                    __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(triangle.v0.x));
+                    __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(triangle.v0.y));
+                    __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(triangle.v0.z));
+                    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDet);
+                    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(e1y, sz));
+                    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(e1z, sx));
+                    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(e1x, sy));
+                    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDet);
+                    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+                    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+                    __m128 hit = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+                    hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+                    hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, tMax)));
+                    if(!_mm_movemask_ps(hit))
+                        continue;
+                    tMax = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, tMax));
+                    __m128i hitLanes = _mm_castps_si128(hit);
+                    found = _mm_or_si128(_mm_and_si128(hitLanes, _mm_set1_epi32(i)), _mm_andnot_si128(hitLanes, found));
+                }
+                continue;
+            }
+            int hitLeft = intersectBox4(nodes[node.first], leftEntry);
+            int hitRight = intersectBox4(nodes[node.first + 1], rightEntry);
+            //the child entered first by one of the rays goes on top
+            if(hitLeft && hitRight && minLane(leftEntry) < minLane(rightEntry)){
+                stack[size++] = node.first + 1;
+                stack[size++] = node.first;
+            }else{
+                if(hitLeft)
+                    stack[size++] = node.first;
+                if(hitRight)
+                    stack[size++] = node.first + 1;
+            }
+        }
+
+        alignas(16) uint32_t foundLanes[4];
+        _mm_store_ps(closest, tMax);
+        _mm_store_si128((__m128i*) foundLanes, found);
+        for(size_t k = 0; k < count; k++){
+            if(foundLanes[k] != BVH_NO_HIT)
+                writeHit(hits[k], foundLanes[k], closest[k], rays[k].direction);
+        }
+    }
+#endif
+};
+
+/* The colliders of the static world: the BVH of every loaded object or streamed tile, already in world space.
+The BVH are built on the workers when their object is loaded, added and removed on the OpenGL thread and
+queried by the simulation thread. A query works on a copy of the list: a BVH removed meanwhile stays alive
+until the query ends.
+*/
+class CollisionWorld {
+public:
+    void add(const std::shared_ptr<const TriangleBVH>& bvh){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(bvh && !bvh->empty())
+            bvhs.push_back(bvh);
+    }
+
+    void remove(const TriangleBVH* bvh){
+        std::lock_guard<std::mutex> lock(mutex);
+        bvhs.erase(std::remove_if(bvhs.begin(), bvhs.end(), [bvh](const std::shared_ptr<const TriangleBVH>& other){
+            return other.get() == bvh;
+        }), bvhs.end());
+    }
+
+    bool intersectRay(const BVHRay& ray, BVHHit& hit) const {
+        bool found = false;
+        for(const std::shared_ptr<const TriangleBVH>& bvh : colliders())
+            found |= bvh->intersectRay(ray, hit);
+        return found;
+    }
+
+    bool intersectSegment(const glm::vec3& from, const glm::vec3& to, BVHHit& hit) const {
+        return intersectRay({from, to - from, 1.0f}, hit);
+    }
+
+    //hits must start empty (BVHHit()) or hold a closer limit
+    void intersectRays(const BVHRay* rays, size_t count, BVHHit* hits) const {
+        for(const std::shared_ptr<const TriangleBVH>& bvh : colliders())
+            bvh->intersectRays(rays, count, hits);
+    }
+
+    bool sweepSphere(const glm::vec3& from, const glm::vec3& to, float radius, BVHHit& hit) const {
+        bool found = false;
+        for(const std::shared_ptr<const TriangleBVH>& bvh : colliders())
+            found |= bvh->sweepSphere(from, to, radius, hit);
+        return found;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bvhs.size();
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<std::shared_ptr<const TriangleBVH>> bvhs;
+
+    std::vector<std::shared_ptr<const TriangleBVH>> colliders() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bvhs;
+    }
+};
+
+#endif
@@ -4,49 +4,54 @@
 
 #include "camera.h"
 #include "plane.h"
+#include "simulation.h"
 
 /*
-void processInput(GLFWwindow* window);
+PlaneInput readPlaneInput(GLFWwindow* window);
+void processCameraInput(GLFWwindow* window, float deltaTime);
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn);
 void mouse_scroll_callback(GLFWwindow* window, double xposIn, double yposIn);
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 */
 
-void processInput(GLFWwindow* window) {
+//the plane keys of the frame, the plane is moved by the simulation thread
+PlaneInput readPlaneInput(GLFWwindow* window) {
 	
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 
 	//plane controls
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		plane.processKeyboardMovement(LEFT);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		plane.processKeyboardMovement(RIGHT);
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		plane.processKeyboardMovement(UPWARD);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		plane.processKeyboardMovement(DOWNWARD);
+	PlaneInput input;
+	input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+	input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+	input.up = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+	input.down = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
 
 	//shoot
-	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
-		plane.shoot(glfwGetTime());
+	input.shoot = glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS || shootClicked;
+	shootClicked = false;
+	return input;
+}
 
-	//camera controls
+//the camera turns on the render thread, deltaTime is the duration of the frame
+void processCameraInput(GLFWwindow* window, float deltaTime) {
+	//camera controls, the rotation speed is per tick
+	float ticks = deltaTime * SIMULATION_TICK_RATE;
 	if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-		camera.ProcessKeyboardRotation(1, 0.0, 1);
+		camera.ProcessKeyboardRotation(1, 0.0, ticks);
 	if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-		camera.ProcessKeyboardRotation(-1, 0.0, 1);
+		camera.ProcessKeyboardRotation(-1, 0.0, ticks);
 	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-		camera.ProcessKeyboardRotation(0.0, 1.0, 1);
+		camera.ProcessKeyboardRotation(0.0, 1.0, ticks);
 	if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-		camera.ProcessKeyboardRotation(0.0, -1.0, 1);
+		camera.ProcessKeyboardRotation(0.0, -1.0, ticks);
 
 	
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods){
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
-        plane.shoot(glfwGetTime());
+        shootClicked = true;
 }
 
 void mouse_scroll_callback(GLFWwindow* window, double xposIn, double yposIn){
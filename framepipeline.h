@@ -0,0 +1,111 @@
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/* Two stage frame pipeline: a producer thread turns the Input of every frame into a Snapshot while the
+thread calling next() draws the Snapshot of the previous frame.
+The snapshots live in two slots used in turn (double buffering): while the consumer draws frame N from one
+slot, the producer writes frame N + 1 in the other. Every snapshot is drawn once and in order, a thread only
+waits when the other one is late. A slot keeps its Snapshot between two uses, the vectors it holds keep their memory.
+*/
+#define FRAME_PIPELINE_SLOTS 2
+
+template<typename Input, typename Snapshot>
+class FramePipeline {
+public:
+    //produce runs on the producer thread only, it may keep state between two calls
+    explicit FramePipeline(std::function<void(const Input&, Snapshot&)> produce) : produce(produce) {
+        producer = std::thread(&FramePipeline::producerLoop, this);
+    }
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    ~FramePipeline(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        producer.join();
+    }
+
+    //queue the input of the next frame and wait for the snapshot of the current one (produced from the input
+    //given by the previous call). The snapshot stays valid until the next call
+    const Snapshot& next(const Input& input){
+        std::unique_lock<std::mutex> lock(mutex);
+        if(reading >= 0)
+            slots[reading].state = SLOT_FREE;
+        if(submitted == 0)//nothing is produced yet, the first frame uses the same input twice
+            submit(input);
+        submit(input);
+        changed.notify_all();
+
+        Slot& slot = slots[consumed % FRAME_PIPELINE_SLOTS];
+        changed.wait(lock, [&slot]{ return slot.state == SLOT_READY; });
+        slot.state = SLOT_READING;
+        reading = consumed % FRAME_PIPELINE_SLOTS;
+        consumed++;
+        return slot.snapshot;
+    }
+
+private:
+    enum SlotState {
+        SLOT_FREE,
+        SLOT_QUEUED,//holds an input, waiting for the producer or being produced
+        SLOT_READY,
+        SLOT_READING
+    };
+
+    struct Slot {
+        Input input;
+        Snapshot snapshot;
+        SlotState state = SLOT_FREE;
+    };
+
+    std::function<void(const Input&, Snapshot&)> produce;
+    std::thread producer;
+    std::mutex mutex;
+    std::condition_variable changed;
+    Slot slots[FRAME_PIPELINE_SLOTS];
+    unsigned long submitted = 0;//frames, the slot of a frame is frame % FRAME_PIPELINE_SLOTS
+    unsigned long produced = 0;
+    unsigned long consumed = 0;
+    int reading = -1;//slot of the snapshot drawn by the consumer
+    bool stopping = false;
+
+    //the lock is held, the slot of the frame is free: it was drawn two frames ago
+    void submit(const Input& input){
+        Slot& slot = slots[submitted % FRAME_PIPELINE_SLOTS];
+        slot.input = input;
+        slot.state = SLOT_QUEUED;
+        submitted++;
+    }
+
+    void producerLoop(){
+        while(true){
+            Slot* slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]{ return stopping || produced < submitted; });
+                if(stopping)
+                    return;
+                slot = &slots[produced % FRAME_PIPELINE_SLOTS];
+            }
+            //the slot stays queued while it is written, the consumer only reads ready slots
+            produce(slot->input, slot->snapshot);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot->state = SLOT_READY;
+                produced++;
+            }
+            changed.notify_all();
+        }
+    }
+};
+
+#endif
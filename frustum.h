@@ -0,0 +1,121 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE
+#include <emmintrin.h>
+#endif
+
+/* View frustum culling of bounding boxes and spheres.
+The planes are extracted from projection * view * model, so they are in the object space of the model
+and the bounds of the meshes are tested without being transformed.
+A mesh is culled when its box or its sphere (both around the same center) is behind one of the 6 planes,
+the box and the sphere are conservative so the tighter of the two is used for each plane.
+*/
+
+//the inside of every plane is dot(plane.xyz, p) + plane.w >= 0, plane.xyz is unit
+struct Frustum {
+    glm::vec4 planes[6];//left, right, bottom, top, near, far
+};
+
+//planes of matrix (Gribb and Hartmann), for an OpenGL clip space with z in [-w, w]
+Frustum makeFrustum(const glm::mat4& matrix){
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+    Frustum frustum;
+    for(int i = 0; i < 3; i++){
+        frustum.planes[2 * i] = rows[3] + rows[i];
+        frustum.planes[2 * i + 1] = rows[3] - rows[i];
+    }
+    for(glm::vec4& plane : frustum.planes){
+        float length = glm::length(glm::vec3(plane));
+        if(length > 0.0f)
+            plane /= length;
+    }
+    return frustum;
+}
+
+//false when the box is entirely behind one plane
+bool frustumContainsBox(const Frustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax){
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f, extent = (boundsMax - boundsMin) * 0.5f;
+    for(const glm::vec4& plane : frustum.planes){
+        glm::vec3 normal = glm::vec3(plane);
+        if(glm::dot(normal, center) + plane.w < -glm::dot(glm::abs(normal), extent))
+            return false;
+    }
+    return true;
+}
+
+//bounds of many meshes, one array per component, padded to a multiple of 4 with bounds always culled
+struct CullBounds {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;//half size of the box
+    std::vector<float> radius;
+    size_t count = 0;
+
+    void resize(size_t count){
+        this->count = count;
+        size_t padded = (count + 3) & ~(size_t)3;
+        for(std::vector<float>* component : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ})
+            component->assign(padded, 0.0f);
+        radius.assign(padded, -1.0f);
+    }
+
+    void set(size_t i, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& center, float sphereRadius){
+        glm::vec3 extent = glm::max(boundsMax - center, center - boundsMin);
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+        radius[i] = sphereRadius;
+    }
+};
+
+//visible[i] is 1 for the bounds in the frustum and 0 for the others, returns the number of visible bounds
+size_t cullBounds(const Frustum& frustum, const CullBounds& bounds, uint8_t* visible){
+    size_t numVisible = 0;
+#ifdef FRUSTUM_SSE
+    for(size_t i = 0; i < bounds.count; i += 4){
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]), cy = _mm_loadu_ps(&bounds.centerY[i]), cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]), ey = _mm_loadu_ps(&bounds.extentY[i]), ez = _mm_loadu_ps(&bounds.extentZ[i]);
+        __m128 r = _mm_loadu_ps(&bounds.radius[i]);
+        __m128 inside = _mm_cmpge_ps(r, _mm_setzero_ps());
+        for(const glm::vec4& plane : frustum.planes){
+            __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+            __m128 boxReach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::fabs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(std::fabs(plane.y)), ey)),
+                                         _mm_mul_ps(_mm_set1_ps(std::fabs(plane.z)), ez));
+            __m128 reach = _mm_min_ps(boxReach, r);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for(size_t k = 0; k < 4 && i + k < bounds.count; k++){
+            visible[i + k] = (mask >> k) & 1;
+            numVisible += visible[i + k];
+        }
+    }
+#else
+    for(size_t i = 0; i < bounds.count; i++){
+        bool inside = bounds.radius[i] >= 0.0f;
+        for(const glm::vec4& plane : frustum.planes){
+            float distance = (plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i]) + (plane.z * bounds.centerZ[i] + plane.w);
+            float boxReach = (std::fabs(plane.x) * bounds.extentX[i] + std::fabs(plane.y) * bounds.extentY[i]) + std::fabs(plane.z) * bounds.extentZ[i];
+            inside = inside && distance + std::min(boxReach, bounds.radius[i]) >= 0.0f;
+        }
+        visible[i] = inside;
+        numVisible += inside;
+    }
+#endif
+    return numVisible;
+}
+
+#endif
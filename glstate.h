@@ -0,0 +1,240 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+/* Shadow copy of the OpenGL bindings changed by the frame loop, a call setting the value already bound is skipped.
+Every bind of the program, vertex array, textures, buffers, depth function and int/float uniforms goes
+through GLState::instance(), on the OpenGL thread only: a direct gl call would leave the shadow copy stale.
+The values start unknown (the first call is always issued), invalidate() forgets them after foreign code.
+The element array buffer belongs to the bound vertex array, it is never tracked.
+*/
+#define GL_STATE_TEXTURE_UNITS 16
+
+struct GLStateCounters {
+    unsigned int issued = 0;//gl calls made
+    unsigned int elided = 0;//gl calls skipped because the value was already set
+};
+
+class GLState {
+public:
+    static GLState& instance(){
+        static GLState state;
+        return state;
+    }
+
+    GLState(const GLState&) = delete;
+    GLState& operator=(const GLState&) = delete;
+
+    void useProgram(GLuint program){
+        if(!changed(currentProgram, program))
+            return;
+        glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vertexArray){
+        if(!changed(currentVertexArray, vertexArray))
+            return;
+        glBindVertexArray(vertexArray);
+    }
+
+    //unit is GL_TEXTURE0 + i, glActiveTexture is only called when the binding changes
+    void bindTexture(GLenum unit, GLenum target, GLuint texture){
+        GLuint* binding = textureBinding(unit, target);
+        if(!binding){
+            activeTexture(unit);
+            counters.issued++;
+            glBindTexture(target, texture);
+            return;
+        }
+        if(!changed(*binding, texture))
+            return;
+        activeTexture(unit);
+        glBindTexture(target, texture);
+    }
+
+    //bindTexture and make the unit active, for the calls changing the texture bound to the active unit
+    void bindTextureToEdit(GLenum unit, GLenum target, GLuint texture){
+        bindTexture(unit, target, texture);
+        activeTexture(unit);
+    }
+
+    void bindBuffer(GLenum target, GLuint buffer){
+        GLuint* binding = bufferBinding(target);
+        if(binding && !changed(*binding, buffer))
+            return;
+        if(!binding)
+            counters.issued++;
+        glBindBuffer(target, buffer);
+    }
+
+    //glBindBufferBase also binds the buffer to the generic target
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer){
+        counters.issued++;
+        glBindBufferBase(target, index, buffer);
+        if(GLuint* binding = bufferBinding(target))
+            *binding = buffer;
+    }
+
+    void depthFunc(GLenum func){
+        if(!changed(currentDepthFunc, func))
+            return;
+        glDepthFunc(func);
+    }
+
+    //uniforms of the program in use, the values are remembered per program
+    void uniform1i(GLint location, GLint value){
+        if(location < 0)
+            return;
+        if(!uniformChanged(location, (uint32_t) value))
+            return;
+        glUniform1i(location, value);
+    }
+
+    void uniform1f(GLint location, GLfloat value){
+        if(location < 0)
+            return;
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        if(!uniformChanged(location, bits))
+            return;
+        glUniform1f(location, value);
+    }
+
+    //program set by the last useProgram, to restore it after a pass using another one
+    GLuint program() const {
+        return currentProgram;
+    }
+
+    //glDelete* reset the bindings of the deleted name to 0
+    void forgetProgram(GLuint program){
+        if(currentProgram == program)
+            currentProgram = 0;
+        for(auto it = uniformValues.begin(); it != uniformValues.end();){
+            if((GLuint)(it->first >> 32) == program)
+                it = uniformValues.erase(it);
+            else
+                ++it;
+        }
+    }
+    void forgetVertexArray(GLuint vertexArray){
+        if(currentVertexArray == vertexArray)
+            currentVertexArray = 0;
+    }
+    void forgetTexture(GLuint texture){
+        for(auto& unit : textures){
+            for(GLuint& binding : unit){
+                if(binding == texture)
+                    binding = 0;
+            }
+        }
+    }
+    void forgetBuffer(GLuint buffer){
+        for(GLuint& binding : buffers){
+            if(binding == buffer)
+                binding = 0;
+        }
+    }
+
+    //the next call of every kind is issued, for code not going through GLState
+    void invalidate(){
+        currentProgram = UNKNOWN;
+        currentVertexArray = UNKNOWN;
+        currentActiveTexture = UNKNOWN;
+        currentDepthFunc = UNKNOWN;
+        for(auto& unit : textures){
+            for(GLuint& binding : unit)
+                binding = UNKNOWN;
+        }
+        for(GLuint& binding : buffers)
+            binding = UNKNOWN;
+        uniformValues.clear();
+    }
+
+    //calls since the last resetCounters, read and reset once per frame
+    const GLStateCounters& frameCounters() const {
+        return counters;
+    }
+    void resetCounters(){
+        counters = GLStateCounters();
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFF;
+    enum { TEXTURE_2D_SLOT, TEXTURE_2D_ARRAY_SLOT, TEXTURE_CUBE_MAP_SLOT, NUM_TEXTURE_SLOTS };
+    enum { ARRAY_BUFFER_SLOT, UNIFORM_BUFFER_SLOT, DRAW_INDIRECT_BUFFER_SLOT, COPY_READ_BUFFER_SLOT, COPY_WRITE_BUFFER_SLOT, NUM_BUFFER_SLOTS };
+
+    GLuint currentProgram = UNKNOWN;
+    GLuint currentVertexArray = UNKNOWN;
+    GLuint currentActiveTexture = UNKNOWN;
+    GLuint currentDepthFunc = UNKNOWN;
+    GLuint textures[GL_STATE_TEXTURE_UNITS][NUM_TEXTURE_SLOTS];
+    GLuint buffers[NUM_BUFFER_SLOTS];
+    //(program << 32 | location) -> bits of the value
+    std::unordered_map<uint64_t, uint32_t> uniformValues;
+    GLStateCounters counters;
+
+    GLState(){
+        invalidate();
+    }
+
+    //count the call, true when it must be issued
+    bool changed(GLuint& current, GLuint value){
+        if(current == value){
+            counters.elided++;
+            return false;
+        }
+        current = value;
+        counters.issued++;
+        return true;
+    }
+
+    bool uniformChanged(GLint location, uint32_t bits){
+        if(currentProgram == UNKNOWN){
+            counters.issued++;
+            return true;
+        }
+        auto inserted = uniformValues.insert(std::make_pair(((uint64_t) currentProgram << 32) | (uint32_t) location, bits));
+        if(!inserted.second && inserted.first->second == bits){
+            counters.elided++;
+            return false;
+        }
+        inserted.first->second = bits;
+        counters.issued++;
+        return true;
+    }
+
+    void activeTexture(GLenum unit){
+        if(!changed(currentActiveTexture, unit))
+            return;
+        glActiveTexture(unit);
+    }
+
+    GLuint* textureBinding(GLenum unit, GLenum target){
+        unsigned int index = unit - GL_TEXTURE0;
+        if(index >= GL_STATE_TEXTURE_UNITS)
+            return nullptr;
+        switch(target){
+        case GL_TEXTURE_2D: return &textures[index][TEXTURE_2D_SLOT];
+        case GL_TEXTURE_2D_ARRAY: return &textures[index][TEXTURE_2D_ARRAY_SLOT];
+        case GL_TEXTURE_CUBE_MAP: return &textures[index][TEXTURE_CUBE_MAP_SLOT];
+        default: return nullptr;
+        }
+    }
+
+    GLuint* bufferBinding(GLenum target){
+        switch(target){
+        case GL_ARRAY_BUFFER: return &buffers[ARRAY_BUFFER_SLOT];
+        case GL_UNIFORM_BUFFER: return &buffers[UNIFORM_BUFFER_SLOT];
+        case GL_DRAW_INDIRECT_BUFFER: return &buffers[DRAW_INDIRECT_BUFFER_SLOT];
+        case GL_COPY_READ_BUFFER: return &buffers[COPY_READ_BUFFER_SLOT];
+        case GL_COPY_WRITE_BUFFER: return &buffers[COPY_WRITE_BUFFER_SLOT];
+        default: return nullptr;
+        }
+    }
+};
+
+#endif
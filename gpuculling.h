@@ -0,0 +1,225 @@
+#ifndef GPUCULLING_H
+#define GPUCULLING_H
+
+#include <glad/glad.h>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "glstate.h"
+
+/* GPU driven culling of the static scenery, needs OpenGL 4.3 (compute shaders, shader storage buffers and
+glMultiDrawElementsIndirect). Without it Object::draw culls on the CPU.
+Every Object keeps its meshes (bounds and LOD levels) in shader storage buffers, in the order of its draw list.
+CULL.comp runs one invocation per mesh: frustum test, LOD selection, then a hierarchical Z test against the
+depth pyramid of the previous frame, and writes the mesh's DrawElementsIndirectCommand with an instanceCount
+of 0 when it is culled. Every draw batch of the object is then one glMultiDrawElementsIndirect over its
+commands: the CPU work does not depend on the number of meshes and nothing is read back.
+The pyramid is built from the depth of the scenery only (buildDepthPyramid is called before the plane and
+the particles are drawn). Level 0 is half the screen and every texel holds the farthest depth of the texels
+below it, the last texel of an odd row or column also covers the extra one. A box is occluded when its
+nearest depth, seen by the previous camera, is behind every texel its rectangle covers: a mesh hidden last
+frame and uncovered by the camera move shows up one frame late.
+*/
+#define GPU_CULL_GROUP_SIZE 64 //invocations of a CULL.comp work group
+#define HIZ_GROUP_SIZE 8 //HIZ.comp work groups are HIZ_GROUP_SIZE x HIZ_GROUP_SIZE texels
+#define HIZ_TEXTURE_UNIT 7 //unit of the pyramid, away from the material textures
+
+//shader storage buffers of an Object, and their bindings in CULL.comp
+enum GPU_CULL_BUFFER {
+    CULL_MESH_BUFFER = 0,
+    CULL_LEVEL_BUFFER = 1,
+    CULL_COMMAND_BUFFER = 2,
+    NUM_CULL_BUFFERS = 3
+};
+
+//argument of glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+//must match the std430 structs of CULL.comp
+struct GpuCullMesh {
+    glm::vec4 centerRadius;//bounding box center and bounding sphere radius, object space
+    glm::vec4 extent;//half size of the box, w unused
+    GLuint firstLevel;//in the level buffer, the full mesh first
+    GLuint numLevels;
+    GLuint command;//command written for this mesh
+    GLuint currentLevel;//level drawn last frame, kept by CULL.comp
+};
+static_assert(sizeof(GpuCullMesh) == 48, "GpuCullMesh must match the std430 layout");
+
+struct GpuCullLevel {
+    GLuint count;
+    GLuint firstIndex;
+    GLfloat error;//distance to the full mesh in object space
+    GLuint padding;
+};
+
+class GpuCulling {
+public:
+    //false when the context is older than OpenGL 4.3
+    static bool isSupported(){
+        return GLAD_GL_VERSION_4_3;
+    }
+
+    //the LOD thresholds are the ones of Object::selectLod
+    GpuCulling(float lodPixelError, float lodHysteresis)
+        : cullShader(PATH_TO_SHADERS"/CULL.comp", makeDefines(lodPixelError, lodHysteresis)),
+          hiZShader(PATH_TO_SHADERS"/HIZ.comp", makeDefines(lodPixelError, lodHysteresis)) {
+        modelViewProjectionUniform = cullShader.getUniform<glm::mat4>("modelViewProjection");
+        previousModelViewProjectionUniform = cullShader.getUniform<glm::mat4>("previousModelViewProjection");
+        modelUniform = cullShader.getUniform<glm::mat4>("model");
+        cameraPositionUniform = cullShader.getUniform<glm::vec3>("cameraPosition");
+        pixelScaleUniform = cullShader.getUniform<GLfloat>("pixelScale");
+        scaleUniform = cullShader.getUniform<GLfloat>("scale");
+        numMeshesUniform = cullShader.getUniform<GLint>("numMeshes");
+        useHiZUniform = cullShader.getUniform<GLint>("useHiZ");
+        depthWidthUniform = cullShader.getUniform<GLint>("depthWidth");
+        depthHeightUniform = cullShader.getUniform<GLint>("depthHeight");
+        sourceLevelUniform = hiZShader.getUniform<GLint>("sourceLevel");
+    }
+
+    GpuCulling(const GpuCulling&) = delete;
+    GpuCulling& operator=(const GpuCulling&) = delete;
+
+    ~GpuCulling(){
+        deleteTextures();
+    }
+
+    //copy the depth of the bound read framebuffer and reduce it to the pyramid tested by the next frame,
+    //viewProjection is the camera the depth was drawn with
+    void buildDepthPyramid(int width, int height, const glm::mat4& viewProjection){
+        if(width <= 0 || height <= 0)
+            return;
+        if(width != depthWidth || height != depthHeight)
+            makeTextures(width, height);
+        GLState& state = GLState::instance();
+        state.bindTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, depthTexture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+        hiZShader.use();
+        int levelWidth = pyramidWidth, levelHeight = pyramidHeight;
+        for(int level = 0; level < pyramidLevels; level++){
+            //level 0 reduces the depth copy, the others the level below
+            state.bindTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+            hiZShader.set(sourceLevelUniform, level == 0 ? 0 : level - 1);
+            glBindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((levelWidth + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (levelHeight + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+        }
+        state.bindTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, pyramidTexture);
+        previousViewProjection = viewProjection;
+        hasPyramid = true;
+    }
+
+    //write the commands of numMeshes meshes of an object, the program in use is restored for its draws
+    void cull(const GLuint buffers[NUM_CULL_BUFFERS], GLuint numMeshes, const glm::mat4& model,
+              const glm::mat4& viewProjection, const glm::vec3& cameraPosition, float pixelScale){
+        if(numMeshes == 0)
+            return;
+        GLState& state = GLState::instance();
+        GLuint drawProgram = state.program();
+        float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+        cullShader.use();
+        cullShader.set(modelViewProjectionUniform, viewProjection * model);
+        cullShader.set(previousModelViewProjectionUniform, previousViewProjection * model);
+        cullShader.set(modelUniform, model);
+        cullShader.set(cameraPositionUniform, cameraPosition);
+        cullShader.set(pixelScaleUniform, pixelScale);
+        cullShader.set(scaleUniform, scale);
+        cullShader.set(numMeshesUniform, (GLint) numMeshes);
+        cullShader.set(useHiZUniform, hasPyramid);
+        cullShader.set(depthWidthUniform, depthWidth);
+        cullShader.set(depthHeightUniform, depthHeight);
+        if(hasPyramid)
+            state.bindTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, pyramidTexture);
+        for(GLuint binding = 0; binding < NUM_CULL_BUFFERS; binding++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffers[binding]);
+        glDispatchCompute((numMeshes + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+        //the commands are read by the indirect draws, the levels kept by the next pass
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        state.useProgram(drawProgram);
+    }
+
+    //forget the pyramid, the next frames are only frustum culled until buildDepthPyramid
+    void invalidate(){
+        hasPyramid = false;
+    }
+
+private:
+    Shader cullShader;
+    Shader hiZShader;
+    Uniform<glm::mat4> modelViewProjectionUniform;
+    Uniform<glm::mat4> previousModelViewProjectionUniform;
+    Uniform<glm::mat4> modelUniform;
+    Uniform<glm::vec3> cameraPositionUniform;
+    Uniform<GLfloat> pixelScaleUniform;
+    Uniform<GLfloat> scaleUniform;
+    Uniform<GLint> numMeshesUniform;
+    Uniform<GLint> useHiZUniform;
+    Uniform<GLint> depthWidthUniform;
+    Uniform<GLint> depthHeightUniform;
+    Uniform<GLint> sourceLevelUniform;
+
+    GLuint depthTexture = 0;//copy of the depth buffer
+    GLuint pyramidTexture = 0;
+    int depthWidth = 0, depthHeight = 0;
+    int pyramidWidth = 0, pyramidHeight = 0, pyramidLevels = 0;
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+    bool hasPyramid = false;
+
+    static std::string makeDefines(float lodPixelError, float lodHysteresis){
+        return "#define GPU_CULL_GROUP_SIZE " + std::to_string(GPU_CULL_GROUP_SIZE) + "\n"
+               "#define HIZ_GROUP_SIZE " + std::to_string(HIZ_GROUP_SIZE) + "\n"
+               "#define HIZ_TEXTURE_UNIT " + std::to_string(HIZ_TEXTURE_UNIT) + "\n"
+               "#define LOD_PIXEL_ERROR " + std::to_string(lodPixelError) + "\n"
+               "#define LOD_HYSTERESIS " + std::to_string(lodHysteresis) + "\n";
+    }
+
+    void makeTextures(int width, int height){
+        deleteTextures();
+        GLState& state = GLState::instance();
+        depthWidth = width;
+        depthHeight = height;
+        glGenTextures(1, &depthTexture);
+        state.bindTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, depthTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        //the mipmap sizes of OpenGL, each level is half the one below rounded down
+        pyramidWidth = std::max(1, width / 2);
+        pyramidHeight = std::max(1, height / 2);
+        pyramidLevels = 1 + (int) std::floor(std::log2((float) std::max(pyramidWidth, pyramidHeight)));
+        glGenTextures(1, &pyramidTexture);
+        state.bindTexture(GL_TEXTURE0 + HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, pyramidTexture);
+        glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, pyramidWidth, pyramidHeight);
+        //texelFetch of the levels above 0 needs a complete mipmapped texture
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        hasPyramid = false;
+    }
+
+    void deleteTextures(){
+        for(GLuint* texture : {&depthTexture, &pyramidTexture}){
+            if(!*texture)
+                continue;
+            glDeleteTextures(1, texture);
+            GLState::instance().forgetTexture(*texture);
+            *texture = 0;
+        }
+    }
+};
+
+#endif
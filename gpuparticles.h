@@ -0,0 +1,226 @@
+#ifndef GPUPARTICLES_H
+#define GPUPARTICLES_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "glstate.h"
+#include "particles.h"
+
+/* Particles simulated on the GPU with transform feedback (OpenGL 4.0, no compute shader needed).
+The particles live in two buffers used in turn: every update reads one of them as points and writes the other.
+PARTICLE_UPDATE.vert moves and ages the particles, PARTICLE_UPDATE.geom only emits the living ones, so the
+dead particles are removed from the buffer in the same pass. The particles added since the last update are
+uploaded in a small buffer and go through the same pass, after the old ones.
+The number of particles never comes back to the CPU: glDrawTransformFeedback draws the count recorded by
+the transform feedback object, for the next update and for PARTICLE_GPU.geom which expands every point to a box.
+When the buffer is full the GPU stops writing: the particles added last are the ones lost.
+A laser flies straight at a constant speed, so its whole path is tested against the CollisionWorld once, when it
+is fired: its life ends where it hits. The geometry streamed in after the shot does not stop it.
+*/
+#define GPU_PARTICLE_CAPACITY 262144
+#define GPU_PARTICLE_MIN_EMIT 256 //first size of the buffer of the new particles
+
+//must match the inputs of PARTICLE_UPDATE.vert and the outputs of PARTICLE_UPDATE.geom
+struct GpuParticle {
+    glm::vec4 positionLife;//life in w
+    glm::vec3 direction;
+    glm::vec3 axisX;//first two columns of the rotation of the plane, the third one is their cross product
+    glm::vec3 axisY;
+};
+static_assert(sizeof(GpuParticle) == 13 * sizeof(float), "GpuParticle must be tightly packed");
+
+const std::vector<std::string> GPU_PARTICLE_VARYINGS = {"tf_positionLife", "tf_direction", "tf_axisX", "tf_axisY"};
+
+class GpuParticles : public ParticleEmitter {
+public:
+    //updateShader is PARTICLE_UPDATE.vert/geom linked with GPU_PARTICLE_VARYINGS, drawShader is PARTICLE_GPU.vert/geom/PARTICLE.frag
+    GpuParticles(Shader* updateShader, Shader* drawShader, size_t capacity = GPU_PARTICLE_CAPACITY)
+        : updateShader(updateShader), drawShader(drawShader), capacity(capacity) {
+        deltaTimeUniform = updateShader->getUniform<GLfloat>("deltaTime");
+        speedUniform = updateShader->getUniform<GLfloat>("speed");
+        drawSpeedUniform = drawShader->getUniform<GLfloat>("speed");
+        timeOffsetUniform = drawShader->getUniform<GLfloat>("timeOffset");
+
+        GLState& state = GLState::instance();
+        glGenBuffers(2, particleBuffers);
+        glGenVertexArrays(2, particleVAOs);
+        glGenTransformFeedbacks(2, feedbacks);
+        for(int i = 0; i < 2; i++){
+            state.bindBuffer(GL_ARRAY_BUFFER, particleBuffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GpuParticle), NULL, GL_DYNAMIC_COPY);
+            setupAttributes(particleVAOs[i], particleBuffers[i]);
+            //the feedback object remembers the buffer it writes
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedbacks[i]);
+            state.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particleBuffers[i]);
+        }
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+        glGenBuffers(1, &emitBuffer);
+        glGenVertexArrays(1, &emitVAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, emitBuffer);
+        glBufferData(GL_ARRAY_BUFFER, emitCapacity * sizeof(GpuParticle), NULL, GL_STREAM_DRAW);
+        setupAttributes(emitVAO, emitBuffer);
+        emitted.reserve(emitCapacity);
+    }
+
+    GpuParticles(const GpuParticles&) = delete;
+    GpuParticles& operator=(const GpuParticles&) = delete;
+
+    ~GpuParticles(){
+        GLState& state = GLState::instance();
+        glDeleteTransformFeedbacks(2, feedbacks);
+        glDeleteVertexArrays(2, particleVAOs);
+        glDeleteVertexArrays(1, &emitVAO);
+        glDeleteBuffers(2, particleBuffers);
+        glDeleteBuffers(1, &emitBuffer);
+        for(int i = 0; i < 2; i++){
+            state.forgetVertexArray(particleVAOs[i]);
+            state.forgetBuffer(particleBuffers[i]);
+        }
+        state.forgetVertexArray(emitVAO);
+        state.forgetBuffer(emitBuffer);
+    }
+
+    void addNew(glm::vec3 direction, glm::vec3 position, glm::mat4 model) override {
+        add(makeParticle(direction, position, model, world));
+    }
+
+    //added to the buffer by the next update
+    void add(const GpuParticle& particle){
+        //more particles than the buffer can hold would be lost anyway
+        if(emitted.size() >= capacity)
+            return;
+        emitted.push_back(particle);
+    }
+
+    //the particle dies where its path hits the world, when there is one
+    static GpuParticle makeParticle(glm::vec3 direction, glm::vec3 position, glm::mat4 model, const CollisionWorld* world = nullptr){
+        float life = PARTICLE_LIFE;
+        if(world){
+            BVHHit hit;
+            if(world->intersectRay({position, direction * (PARTICLE_SPEED * PARTICLE_LIFE), 1.0f}, hit))
+                life = hit.distance * PARTICLE_LIFE;
+        }
+        GpuParticle particle;
+        particle.positionLife = glm::vec4(position, life);
+        particle.direction = direction;
+        particle.axisX = glm::vec3(model[0]);
+        particle.axisY = glm::vec3(model[1]);
+        return particle;
+    }
+
+    //move, age and compact the particles on the GPU, then add the new ones
+    void update(float deltaTime){
+        if(!hasParticles && emitted.empty())
+            return;
+        GLState& state = GLState::instance();
+        int target = 1 - current;
+
+        updateShader->use();
+        updateShader->set(deltaTimeUniform, deltaTime);
+        updateShader->set(speedUniform, PARTICLE_SPEED);
+
+        if(!emitted.empty()){
+            state.bindBuffer(GL_ARRAY_BUFFER, emitBuffer);
+            if(emitted.size() > emitCapacity){
+                emitCapacity = std::max(emitted.size(), emitCapacity * 2);
+                emitted.reserve(emitCapacity);
+            }
+            //orphan the storage of the previous update
+            glBufferData(GL_ARRAY_BUFFER, emitCapacity * sizeof(GpuParticle), NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, emitted.size() * sizeof(GpuParticle), emitted.data());
+        }
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedbacks[target]);
+        glBeginTransformFeedback(GL_POINTS);
+        if(hasParticles){
+            state.bindVertexArray(particleVAOs[current]);
+            glDrawTransformFeedback(GL_POINTS, feedbacks[current]);
+        }
+        if(!emitted.empty()){
+            state.bindVertexArray(emitVAO);
+            glDrawArrays(GL_POINTS, 0, emitted.size());
+            emitted.clear();
+        }
+        glEndTransformFeedback();
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        current = target;
+        hasParticles = true;
+    }
+
+    //static geometry stopping the particles, none when null
+    const CollisionWorld* world = nullptr;
+
+    //one point per particle, expanded to a box by the geometry shader, see Particles::draw for timeOffset
+    void draw(float timeOffset = 0.0f){
+        if(!hasParticles)
+            return;
+        drawShader->use();
+        drawShader->set(drawSpeedUniform, PARTICLE_SPEED);
+        drawShader->set(timeOffsetUniform, timeOffset);
+        GLState::instance().bindVertexArray(particleVAOs[current]);
+        glDrawTransformFeedback(GL_POINTS, feedbacks[current]);
+        Object::drawCalls()++;
+    }
+
+private:
+    Shader* updateShader;
+    Shader* drawShader;
+    Uniform<GLfloat> deltaTimeUniform;
+    Uniform<GLfloat> speedUniform;
+    Uniform<GLfloat> drawSpeedUniform;
+    Uniform<GLfloat> timeOffsetUniform;
+    const size_t capacity;
+
+    GLuint particleBuffers[2] = {0, 0};
+    GLuint particleVAOs[2] = {0, 0};
+    GLuint feedbacks[2] = {0, 0};//feedbacks[i] writes particleBuffers[i]
+    int current = 0;//buffer holding the particles
+    bool hasParticles = false;//false until the first update, feedbacks[current] has no count yet
+
+    std::vector<GpuParticle> emitted;//added since the last update
+    GLuint emitBuffer = 0;
+    GLuint emitVAO = 0;
+    size_t emitCapacity = GPU_PARTICLE_MIN_EMIT;
+
+    void setupAttributes(GLuint vertexArray, GLuint buffer){
+        GLState& state = GLState::instance();
+        state.bindVertexArray(vertexArray);
+        state.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*) offsetof(GpuParticle, positionLife));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*) offsetof(GpuParticle, direction));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*) offsetof(GpuParticle, axisX));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void*) offsetof(GpuParticle, axisY));
+        state.bindVertexArray(0);
+    }
+};
+
+//the particles fired on a thread without OpenGL, the OpenGL thread adds them to the GpuParticles before the update of their step
+class GpuParticleRecorder : public ParticleEmitter {
+public:
+    struct Record {
+        int step;//in the frame
+        GpuParticle particle;
+    };
+
+    int step = 0;//set by the simulation before every step
+    std::vector<Record> records;
+    const CollisionWorld* world = nullptr;//tested when the particles are fired, like GpuParticles::world
+
+    void addNew(glm::vec3 direction, glm::vec3 position, glm::mat4 model) override {
+        records.push_back({step, GpuParticles::makeParticle(direction, position, model, world)});
+    }
+};
+
+#endif
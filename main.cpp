@@ -8,6 +8,9 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <map>
+#include <set>
+#include <memory>
+#include <cstdlib>
 
 #include "camera.h"
 #include "plane.h"
@@ -15,6 +18,14 @@
 #include "object.h"
 #include "utils.h"
 #include "particles.h"
+#include "gpuparticles.h"
+#include "benchmarks.h"
+#include "assetloader.h"
+#include "worldstream.h"
+#include "uniformbuffers.h"
+#include "timestep.h"
+#include "simulation.h"
+#include "framepipeline.h"
 
 Camera camera(glm::vec3(0.0, 2.0, 5.0));
 Plane plane(glm::vec3(-400.0f, 12.0f, -982.0f));
@@ -24,18 +35,70 @@ double lastX = WINDOWS_WIDTH / 2.0;
 double lastY = WINDOWS_HEIGHT / 2.0;
 double sensibilityMouse = 0.3;
 bool firstMouse = true;
+bool shootClicked = false;//read with the keys of the next frame
 #include "callbacks.h" //those variables are used in callbacks
 
 
 int main(int argc, char* argv[]){
 
+	char pathPlane[] = PATH_TO_OBJECTS "/futuristic_combat_jet.dae";
+	char pathCube[] = PATH_TO_OBJECTS "/cube.obj";
+	char pathGround[] = PATH_TO_OBJECTS "/ground2.fbx";
+	char pathCity[] = PATH_TO_OBJECTS "/Sci-fi Tropical city.obj";
+
+	//load options of the objects, the startup benchmark times the caches written with them
+	const unsigned int planeLoadOptions = OBJECT_LOAD_OPTIMIZE | OBJECT_LOAD_LOD;
+	const unsigned int groundLoadOptions = OBJECT_LOAD_OPTIMIZE | OBJECT_LOAD_PACK_MATERIALS;
+	const unsigned int cubeLoadOptions = OBJECT_LOAD_DEFAULT;
+
+	std::string pathToDayCubeMap = PATH_TO_TEXTURES "/cubemaps/cloudsv2/";
+	std::string pathToNightCubeMap = PATH_TO_TEXTURES "/cubemaps/yokohama3/";
+
+	//the flags can be combined, e.g. "--sim-hz 30 --gpu-culling --gpu-particles"
+	std::set<std::string> arguments;
+	//rate of the simulation steps, the frame rate is free
+	double simulationHz = SIMULATION_HZ;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--sim-hz" && i + 1 < argc)
+			simulationHz = std::max(1.0, std::atof(argv[++i]));
+		else
+			arguments.insert(arg);
+	}
+
+	if (arguments.count("--bench-startup")) {
+		benchStartup({{pathCube, cubeLoadOptions}, {pathPlane, planeLoadOptions}, {pathGround, groundLoadOptions}});
+		return 0;
+	}
+	if (arguments.count("--bench-particles")) {
+		benchParticles();
+		return 0;
+	}
+	if (arguments.count("--bench-collisions")) {
+		benchCollisions(pathCity);
+		return 0;
+	}
+	if (arguments.count("--bench-occlusion")) {
+		return benchOcclusion() ? 0 : 1;
+	}
+	if (arguments.count("--cook")) {
+		cookAssets({pathCube, pathPlane, pathCity, pathGround}, {pathToDayCubeMap, pathToNightCubeMap});
+		cookWorldTiles(pathCity, WORLD_TILE_SIZE);
+		return 0;
+	}
+
+	//the laser particles are simulated and drawn on the GPU, the CPU only uploads the new ones
+	bool gpuParticles = arguments.count("--gpu-particles") > 0;
+	//the city and the ground are culled on the GPU and drawn by indirect draws, needs OpenGL 4.3
+	bool gpuCulling = arguments.count("--gpu-culling") > 0;
+
 	//Boilerplate
 	//Create the OpenGL context 
 	if (!glfwInit()) {
 		throw std::runtime_error("Failed to initialise GLFW \n");
 	}
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, gpuCulling ? 3 : 0);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifndef NDEBUG
@@ -45,17 +108,34 @@ int main(int argc, char* argv[]){
 
 	//Create the window
 	GLFWwindow* window = glfwCreateWindow(WINDOWS_WIDTH, WINDOWS_HEIGHT, "Lava planet", nullptr, nullptr);
+	if (window == NULL && gpuCulling){
+		//without OpenGL 4.3 the game runs with the CPU culling
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+		window = glfwCreateWindow(WINDOWS_WIDTH, WINDOWS_HEIGHT, "Lava planet", nullptr, nullptr);
+	}
 	if (window == NULL){
 		glfwTerminate();
 		throw std::runtime_error("Failed to create GLFW window\n");
 	}
 
 	glfwMakeContextCurrent(window);
+	//destroy the window after every local below, textures free their OpenGL storage when released
+	struct WindowGuard {
+		GLFWwindow* window;
+		~WindowGuard() {
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}
+	} windowGuard = {window};
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);//TODO change ot GLFW_CURSOR_DISABLED
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	//load openGL function
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 		throw std::runtime_error("Failed to initialize GLAD");
+	if (gpuCulling && !GpuCulling::isSupported()) {
+		std::cout << "OpenGL 4.3 is not available, the meshes are culled on the CPU" << std::endl;
+		gpuCulling = false;
+	}
 	
 	glEnable(GL_DEPTH_TEST);
 
@@ -82,36 +162,68 @@ int main(int argc, char* argv[]){
 	std::cout << "Loading particle shader" << std::endl;
 	Shader particleShader(PATH_TO_SHADERS"/PARTICLE.vert", PATH_TO_SHADERS"/PARTICLE.frag");
     std::cout << "Particle shaders loaded" << std::endl;
-	
-	char pathPlane[] = PATH_TO_OBJECTS "/futuristic_combat_jet.dae";
-	char pathCube[] = PATH_TO_OBJECTS "/cube.obj";
-	char pathGround[] = PATH_TO_OBJECTS "/ground2.fbx";
-	char pathCity[] = PATH_TO_OBJECTS "/Sci-fi Tropical city.obj";
 
-	Object particleObject(pathCube);
-	particleObject.makeObject(particleShader);
+	//camera and light uniforms are written once per frame in buffers read by every program
+	UniformBuffer<FrameData> frameBuffer(FRAME_DATA_BINDING);
+	UniformBuffer<LightData> lightBuffer(LIGHT_DATA_BINDING);
+	bindSharedUniformBlocks(lightShader);
+	bindSharedUniformBlocks(cubeMapShader);
+	bindSharedUniformBlocks(particleShader);
+
+	std::unique_ptr<Shader> particleUpdateShader, particleDrawShader;
+	if (gpuParticles) {
+		std::cout << "Loading GPU particle shaders" << std::endl;
+		particleUpdateShader.reset(new Shader(PATH_TO_SHADERS"/PARTICLE_UPDATE.vert", PATH_TO_SHADERS"/PARTICLE_UPDATE.geom", nullptr, GPU_PARTICLE_VARYINGS));
+		particleDrawShader.reset(new Shader(PATH_TO_SHADERS"/PARTICLE_GPU.vert", PATH_TO_SHADERS"/PARTICLE_GPU.geom", PATH_TO_SHADERS"/PARTICLE.frag", {}));
+		bindSharedUniformBlocks(*particleDrawShader);
+		std::cout << "GPU particle shaders loaded" << std::endl;
+	}
+
+	std::unique_ptr<GpuCulling> gpuCullingPass;
+	if (gpuCulling) {
+		std::cout << "Loading GPU culling shaders" << std::endl;
+		gpuCullingPass.reset(new GpuCulling(LOD_PIXEL_ERROR, LOD_HYSTERESIS));
+		std::cout << "GPU culling shaders loaded" << std::endl;
+	}
+	
+	//Import and decode on worker threads, only the OpenGL uploads run here
+	//the meshes drawn with LIGHT.vert are reordered for the vertex cache when their mesh cache is written,
+	//the jet also gets its LOD levels then (the city tiles get theirs when they are cooked)
+	AssetLoader loader;
+	//the BVH of the city tiles and of the ground stop the plane and the lasers
+	CollisionWorld collisions;
+	plane.world = &collisions;
+
+	Object particleObject;
+	loadObjectAsync(loader, &particleObject, pathCube, &particleShader, VERTEX_FORMAT_FLOAT, PRIORITY_FIRST_FRAME, PRIORITY_FIRST_FRAME);
 	Particles particles(&particleShader, &particleObject);
-	plane.particles = &particles;
+	std::unique_ptr<GpuParticles> gpuParticleSystem;
+	if (gpuParticles) {
+		gpuParticleSystem.reset(new GpuParticles(particleUpdateShader.get(), particleDrawShader.get()));
+		gpuParticleSystem->world = &collisions;
+		plane.particles = gpuParticleSystem.get();
+	}
+	else {
+		particles.world = &collisions;
+		plane.particles = &particles;
+	}
 
-	Object planeObj(pathPlane);
-	planeObj.makeObject(lightShader);
+	Object planeObj;
+	loadObjectAsync(loader, &planeObj, pathPlane, &lightShader, VERTEX_FORMAT_PACKED, PRIORITY_FIRST_FRAME, PRIORITY_FIRST_FRAME, planeLoadOptions);
 	glm::mat4 modelPlane = glm::mat4(1.0f);
 	modelPlane = glm::scale(modelPlane, glm::vec3(0.2f, 0.2f, 0.2f));
 	modelPlane = glm::rotate(modelPlane, (float) glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	modelPlane = glm::rotate(modelPlane, (float) glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 		
-	
-	Object city(pathCity);
-	city.makeObject(lightShader);
+	//city and ground textures can pop in after the first frame
 	glm::mat4 modelCity = glm::mat4(1.0f);
 	modelCity = glm::rotate(modelCity, (float) glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	modelCity = glm::translate(modelCity, glm::vec3(0.0f, -30.0f, 0.0f));
 	glm::mat4 inverseModelCity = glm::transpose( glm::inverse(modelCity));
-	
-	glfwPollEvents();//Avoid window not responding during boot
-
-	Object ground(pathGround);
-	ground.makeObject(lightShader);
+	//the city is streamed by tiles around the plane, the tiles are cooked on the first start
+	WorldStreamer city(loader, pathCity, &lightShader, modelCity);
+	city.setCollisionWorld(&collisions);
+	city.open(PRIORITY_FIRST_FRAME);
 
 	glm::mat4 modelGround = glm::mat4(1.0f);
 	modelGround = glm::scale(modelGround, glm::vec3(1500.0f, 3000.0f, 1500.0f));
@@ -119,12 +231,33 @@ int main(int argc, char* argv[]){
 	modelGround = glm::translate(modelGround, glm::vec3(0.0f, 0.0f, -0.16f));//ground to zero
 	glm::mat4 inverseModelGround = glm::transpose( glm::inverse(modelGround));
 
-	glfwPollEvents();//Avoid window not responding during boot
+	Object ground;
+	loadObjectAsync(loader, &ground, pathGround, &lightShader, VERTEX_FORMAT_PACKED, PRIORITY_FIRST_FRAME, PRIORITY_DETAIL, groundLoadOptions,
+	                &collisions, modelGround);
 
-	Object cubeMap(pathCube);
-	cubeMap.makeObject(cubeMapShader);
+	Object cubeMap;
+	loadObjectAsync(loader, &cubeMap, pathCube, &cubeMapShader, VERTEX_FORMAT_FLOAT, PRIORITY_FIRST_FRAME, PRIORITY_FIRST_FRAME, cubeLoadOptions);
 
-	glm::vec3 light_pos = glm::vec3(0.0f, 0.1f, 0.0f);
+	//Create the day sky cubemap texture
+	GLuint dayCubeMapTexture = 0;
+	loadCubemapAsync(loader, &dayCubeMapTexture, pathToDayCubeMap, PRIORITY_FIRST_FRAME);
+
+	//Boot screen, keep presenting frames until everything needed by the first frame is uploaded
+	while (!loader.isDone(PRIORITY_FIRST_FRAME) && !glfwWindowShouldClose(window)) {
+		glfwPollEvents();
+		loader.processUploads(10.0);
+		//the tiles around the start position are needed by the first frame
+		city.update(plane.position, plane.front, PRIORITY_FIRST_FRAME);
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		drawLoadingScreen(loader.progress(), width, height);
+		glfwSwapBuffers(window);
+	}
+	TextureCache::instance().printStats();
+
+	//the night sky is decoded in the background once the game runs
+	GLuint nightCubeMapTexture = 0;
+	loadCubemapAsync(loader, &nightCubeMapTexture, pathToNightCubeMap, PRIORITY_BACKGROUND);
 
 	double prev = 0;
 	int deltaFrame = 0;
@@ -132,11 +265,27 @@ int main(int argc, char* argv[]){
 	auto fps = [&](double now) {
 		double deltaTime = now - prev;
 		deltaFrame++;
+		//uniform lookups of the frame, 0 when every uniform of the frame loop goes through a handle
+		unsigned int nameLookups = Shader::nameLookups();
+		unsigned int driverLookups = Shader::driverLookups();
+		Shader::resetLookupCounters();
+		//OpenGL state changes of the frame, the elided ones were already set
+		GLStateCounters stateCalls = GLState::instance().frameCounters();
+		GLState::instance().resetCounters();
+		unsigned int drawCalls = Object::drawCalls();
+		Object::resetDrawCalls();
+		CullCounters culling = Object::cullCounters();
+		Object::resetCullCounters();
+		unsigned int tested = culling.visible + culling.culled + culling.occluded;
 		if (deltaTime > 0.5) {
 			prev = now;
 			const double fpsCount = (double)deltaFrame / deltaTime;
 			deltaFrame = 0;
-			std::cout << "\r FPS: " << fpsCount;
+			std::cout << "\r FPS: " << fpsCount << " uniform lookups per frame: " << nameLookups << " by name, " << driverLookups << " driver"
+			          << ", state calls per frame: " << stateCalls.issued << " issued, " << stateCalls.elided << " elided"
+			          << ", draw calls: " << drawCalls << ", meshes: " << culling.visible << " visible, "
+			          << (tested ? 100 * culling.culled / tested : 0) << "% out of the frustum, " << (tested ? 100 * culling.occluded / tested : 0) << "% occluded, "
+			          << culling.gpuTested << " tested on the GPU";
 			std::cout.flush();
 		}
 	};
@@ -144,31 +293,14 @@ int main(int argc, char* argv[]){
 	glm::mat4 view = camera.GetViewMatrix();
 	glm::mat4 perspective = camera.GetProjectionMatrix();
 
-	float ambientDay = 0.5;
-	float ambientNight = 0.2;
-	float diffuseDay = 0.5;
-	float diffuseNight = 0.2;
-	float specularDay = 0.5;
-	float specularNight = 0.5;
-
 	//Rendering
-	lightShader.use();
-	lightShader.setFloat("light.ambient_strength", ambientDay);
-	lightShader.setFloat("light.diffuse_strength", diffuseDay);
-	lightShader.setFloat("light.specular_strength", specularDay);
-	lightShader.setFloat("light.constant", 1.0);//no attenuation for sun light
-	lightShader.setFloat("light.linear", 0);
-	lightShader.setFloat("light.quadratic", 0);
+	FrameData frameData = {};
 
+	//uniforms set every frame, resolved once so the frame loop does no lookup
+	Uniform<glm::mat4> lightModel = lightShader.getUniform<glm::mat4>("M");
+	Uniform<glm::mat4> lightNormalMatrix = lightShader.getUniform<glm::mat4>("itM");
+	Uniform<GLint> cubeMapTexture = cubeMapShader.getUniform<GLint>("cubemapSampler");
 
-	//Create the day sky cubemap texture
-	GLuint dayCubeMapTexture;
-	std::string pathToDayCubeMap = PATH_TO_TEXTURES "/cubemaps/cloudsv2/";
-    genCubemapTexture(&dayCubeMapTexture, pathToDayCubeMap);
-
-	GLuint nightCubeMapTexture;
-	std::string pathToNightCubeMap = PATH_TO_TEXTURES "/cubemaps/yokohama3/";
-    genCubemapTexture(&nightCubeMapTexture, pathToNightCubeMap);
 
 	//start to record mouse movement when everything is loaded
 	glfwPollEvents();
@@ -176,118 +308,133 @@ int main(int argc, char* argv[]){
 	glfwSetScrollCallback(window, mouse_scroll_callback);
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 
-    bool lastFrameDay = true;
-    int timeSlowdown = 20;
+	OcclusionBuffer occlusion;
+	unsigned int occlusionThreads = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
 
+	//the plane, the particles and the light are simulated by fixed steps on another thread while this one draws
+	//the previous frame, see simulation.h. From now on the plane and the CPU particles belong to the simulation
+	Simulation simulation(plane, gpuParticleSystem ? nullptr : &particles, simulationHz);
+	FramePipeline<FrameInput, RenderSnapshot> pipeline([&simulation](const FrameInput& input, RenderSnapshot& snapshot) {
+		simulation.run(input, snapshot);
+	});
     double lastTime = glfwGetTime();
 	
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
-		processInput(window);
-		plane.updateState();
-		camera.updateCameraVectors(plane.yaw);
-		camera.updatePosition(plane.position);
+		//finish the remaining assets without stalling the frame
+		loader.processUploads(2.0);
+
+		double realTime = glfwGetTime();
+		processCameraInput(window, realTime - lastTime);
+		lastTime = realTime;
+		//the snapshot of the keys read last frame, the simulation starts on the ones of this frame
+		FrameInput frameInput;
+		frameInput.time = realTime;
+		frameInput.plane = readPlaneInput(window);
+		const RenderSnapshot& snapshot = pipeline.next(frameInput);
+
+		city.update(snapshot.planePosition, snapshot.planeFront, PRIORITY_DETAIL);
+		camera.updateCameraVectors(snapshot.plane.yaw);
+		camera.updatePosition(snapshot.plane.position);
 		view = camera.GetViewMatrix();
+		int framebufferWidth, framebufferHeight;
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		LodView lodView = makeLodView(camera.Position, perspective, view, framebufferHeight);
+		//the closest buildings hide the ones behind them, tested before their draw
+		//(the GPU culling tests them against the depth of the previous frame instead)
+		LodView sceneryView = lodView;
+		if (gpuCullingPass) {
+			sceneryView.gpuCulling = gpuCullingPass.get();
+		}
+		else {
+			occlusion.begin(lodView.viewProjection);
+			city.addOccluders(occlusion, lodView);
+			occlusion.rasterize(occlusionThreads);
+			lodView.occlusion = &occlusion;
+			sceneryView.occlusion = &occlusion;
+		}
 		
-		double now = glfwGetTime();
-		float dt = now - lastTime;
-		lastTime = now;
-        now =  (now + 3.14* timeSlowdown) / timeSlowdown;//add constant to start at night
-        
+
 		glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		
+		frameData.view = view;
+		frameData.projection = perspective;
+		frameData.viewProjection = perspective * view;
+		frameData.cameraPosition = glm::vec4(camera.Position, 1.0f);
+		frameData.timeOfDay = snapshot.timeOfDay;
+		frameBuffer.update(frameData);
+		lightBuffer.update(snapshot.light);
 
 		lightShader.use();
-		lightShader.setMatrix4("V", view);
-		lightShader.setMatrix4("P", perspective);
-		lightShader.setVector3f("u_view_pos", camera.Position);
-
-		
-		float sinTime = std::sin(now);
-
-		auto delta = light_pos +  glm::vec3(5000.0 * std::cos(now), 5000.0 * sinTime, 0.0);//Put the sun far away
-
-		float ambient = ambientDay;
-        float diffuse = diffuseDay;
-		float specular = specularDay;
-        if(sinTime < 0){//night
-			delta = glm::vec3(5000.0* 0.75, 0.0, 5000.0* 1);//position of moon
-			ambient = ambientNight;
-			diffuse = diffuseNight;
-			specular = specularNight;
-		}else if(sinTime < 0.2f){//sunset or sunrise
-			float sunProgress = sinTime / 0.2f;
-            diffuse = diffuseNight +  sunProgress * (diffuseDay - diffuseNight);
-			ambient = ambientNight +  sunProgress * (ambientDay - ambientNight);
-			specular = specularNight +  sunProgress * (specularDay - specularNight);
-		}
-		
-		lightShader.setVector3f("light.light_pos", delta);
-		lightShader.setFloat("light.specular_strength", specular);
-		lightShader.setFloat("light.ambient_strength",  ambient);
-	    lightShader.setFloat("light.diffuse_strength", diffuse);
 
 		//std::cout << plane.position.x << ":" << plane.position.y << ":" << plane.position.z << std::endl;
 		
 		
-        lightShader.setMatrix4("M", modelCity);
-		lightShader.setMatrix4("itM", inverseModelCity);
-		city.draw();
+        lightShader.set(lightModel, modelCity);
+		lightShader.set(lightNormalMatrix, inverseModelCity);
+		city.draw(sceneryView);
 		
 
-        lightShader.setMatrix4("M", modelGround);
-		lightShader.setMatrix4("itM", inverseModelGround);
-		ground.draw();
+        lightShader.set(lightModel, modelGround);
+		lightShader.set(lightNormalMatrix, inverseModelGround);
+		ground.draw(modelGround, sceneryView);
+		//the depth of the scenery hides the meshes of the next frame, the plane moves with the camera
+		if (gpuCullingPass)
+			gpuCullingPass->buildDepthPyramid(framebufferWidth, framebufferHeight, lodView.viewProjection);
 
-		glm::mat4 planeModelMatrix = plane.getModelMatrix();
+		glm::mat4 planeModelMatrix = Plane::getModelMatrix(snapshot.plane);
 		planeModelMatrix =  planeModelMatrix * modelPlane;
 		
 		glm::mat4 inverseModelAvion = glm::transpose( glm::inverse(planeModelMatrix));
 
-		lightShader.setMatrix4("M", planeModelMatrix);
-		lightShader.setMatrix4("itM", inverseModelAvion);
-        planeObj.draw();
-
-
-		//Draw particles (laser)
-		particleShader.use();
-		particleShader.setMatrix4("V", view);
-		particleShader.setMatrix4("P", perspective);
-		particles.update(dt);
-		particles.draw();
+		lightShader.set(lightModel, planeModelMatrix);
+		lightShader.set(lightNormalMatrix, inverseModelAvion);
+        planeObj.draw(planeModelMatrix, lodView);
+
+
+		//Draw particles (laser), moved back to the time of the frame
+		if (gpuParticleSystem) {
+			//the steps of the snapshot, with the particles fired by each of them
+			size_t fired = 0;
+			for (int i = 0; i < snapshot.steps; i++) {
+				for (; fired < snapshot.firedParticles.size() && snapshot.firedParticles[fired].step == i; fired++)
+					gpuParticleSystem->add(snapshot.firedParticles[fired].particle);
+				gpuParticleSystem->update(snapshot.stepTime);
+			}
+			gpuParticleSystem->draw(snapshot.particleTimeOffset);
+		}
+		else {
+			particleShader.use();
+			particles.drawInstances(snapshot.particles);
+		}
 		
 		//now, draw the cubemap
-		glDepthFunc(GL_LEQUAL);
+		GLState::instance().depthFunc(GL_LEQUAL);
 		//Use the shader for the cube map
 		cubeMapShader.use();
 		//Set the relevant uniform
-        cubeMapShader.setVector3f("light_pos", delta);//To print the sun hallo
-		cubeMapShader.setFloat("timeOfDay", std::sin(now));
-		cubeMapShader.setMatrix4("V", view);
-		cubeMapShader.setMatrix4("P", perspective);
-		cubeMapShader.setInteger("cubemapTexture", 0);
+		cubeMapShader.set(cubeMapTexture, 0);
 		
 
-        glActiveTexture(GL_TEXTURE0);
 		// bind the texture for the cubemap
-        if(std::sin(now) > 0){//day
-            glBindTexture(GL_TEXTURE_CUBE_MAP, dayCubeMapTexture);
-        }else{//night
-            glBindTexture(GL_TEXTURE_CUBE_MAP, nightCubeMapTexture);
+        if(snapshot.timeOfDay > 0){//day
+            GLState::instance().bindTexture(GL_TEXTURE0, GL_TEXTURE_CUBE_MAP, dayCubeMapTexture);
+        }else{//night, the day sky is used until the night one is loaded
+            GLState::instance().bindTexture(GL_TEXTURE0, GL_TEXTURE_CUBE_MAP, nightCubeMapTexture ? nightCubeMapTexture : dayCubeMapTexture);
 
         }
 		//Draw the cubemap
 		cubeMap.draw();
 
-		glDepthFunc(GL_LESS);
+		GLState::instance().depthFunc(GL_LESS);
         
-		fps(now);
+		fps(realTime);
 		glfwSwapBuffers(window);
 	}
 
-	//clean up ressource
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	//clean up ressource, the window is destroyed by windowGuard
+	loader.stop();//the workers may still use the objects
 
 	return 0;
 }
@@ -0,0 +1,350 @@
+#ifndef MATERIALARRAYS_H
+#define MATERIALARRAYS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "stb_image.h"
+#include "texturecook.h" //stb_image_resize
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "stb_rect_pack.h"
+#include "glstate.h"
+
+/* Material textures packed in a few GL_TEXTURE_2D_ARRAYs shared by every packed object, so an object (and
+the whole scenery) draws with the same texture bindings and its batches are no longer split by material.
+The layers are RGBA8, every array holds the textures of one size (MATERIAL_MAX_ARRAYS sizes at most):
+- a texture larger than MATERIAL_ATLAS_MAX_SIZE gets a layer of its own in the array of its size. It is only
+  resampled to MATERIAL_LAYER_SIZE square, in the first array, when it is larger than that or when every
+  array already holds another size,
+- the smaller ones are packed with stb_rect_pack in atlas layers of the first array, surrounded by MATERIAL_ATLAS_PADDING
+  texels copied from their opposite side so the filtering of a repeated texture wraps inside its rectangle.
+  The padding only covers the first mip levels: past MATERIAL_ATLAS_MAX_LOD a texel would mix the neighbours
+  of the rectangle, LIGHT.frag clamps the level of the atlas entries to it (MaterialSlot::maxLod).
+LIGHT.frag reads the array, the layer and the rectangle (MaterialSlot) of every texture in the MaterialTable block of the
+object, and wraps the coordinates in the rectangle itself (with the gradients of the unwrapped coordinates).
+The images are decoded, placed and reduced to their mip levels on the workers (prepare), the OpenGL thread
+only copies the levels in their rectangle (upload): an atlas entry has the levels its padding covers, padded
+to a multiple of their size so every level stays aligned, a layer of its own has the whole chain.
+The arrays grow by doubling. A texture keeps its place until the end of the run.
+The layers are not compressed: the cooked DXT textures are only used by the objects that are not packed.
+*/
+#define MATERIAL_LAYER_SIZE 2048 //layers of the first array, which holds the atlases
+#define MATERIAL_ATLAS_MAX_SIZE 512 //textures up to this size on both sides share atlas layers
+#define MATERIAL_ATLAS_PADDING 8
+#define MATERIAL_ATLAS_MAX_LOD 3 //log2(MATERIAL_ATLAS_PADDING), the last mip level with a texel of padding
+#define MATERIAL_NO_MAX_LOD 1000.0f //the textures with a layer of their own use the whole mip chain
+#define MATERIAL_FIRST_LAYERS 4 //layers of the first array when it is created, the others start with one
+#define MATERIAL_MAX_ARRAYS 4 //texture sizes, must match LIGHT.frag
+#define MATERIAL_TEXTURE_UNIT 3 //unit of the first array, after the 3 textures of the unpacked materials
+#define MATERIAL_TABLE_BINDING 2 //uniform block binding of the MaterialTable of the object drawn
+#define MATERIAL_TABLE_SIZE 64 //materials of a packed object, must match LIGHT.frag
+
+//where a texture is in the arrays
+struct MaterialSlot {
+    glm::vec4 transform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);//scale of the coordinates in xy, offset in zw
+    int array = 0;
+    int layer = -1;//-1 until the texture is uploaded, or when it can not be decoded
+    float maxLod = MATERIAL_NO_MAX_LOD;//highest mip level sampled
+};
+
+//one material of the MaterialTable block of LIGHT.frag, std140
+struct MaterialTableEntry {
+    glm::vec4 diffuse;//MaterialSlot::transform of every texture
+    glm::vec4 specular;
+    glm::vec4 normal;
+    glm::ivec4 layers;//diffuse, specular and normal layer, -1 without texture
+    glm::ivec4 arrays;//array of the diffuse, specular and normal textures
+    glm::vec4 maxLods;//MaterialSlot::maxLod of the diffuse, specular and normal textures
+};
+static_assert(sizeof(MaterialTableEntry) == 96, "MaterialTableEntry must match the std140 layout");
+static_assert((1 << MATERIAL_ATLAS_MAX_LOD) == MATERIAL_ATLAS_PADDING, "the padding must cover the mip levels sampled");
+
+//a decoded image placed in an array, waiting for its upload
+struct PendingLayer {
+    std::string path;
+    MaterialSlot slot;
+    int x = 0, y = 0, width = 0, height = 0;//texels written in level 0 of the layer, padding included
+    std::vector<std::vector<unsigned char>> levels;//RGBA, level 0 first, each half the size of the previous one
+};
+
+class MaterialArrays {
+public:
+    static MaterialArrays& instance(){
+        static MaterialArrays arrays;
+        return arrays;
+    }
+
+    MaterialArrays(const MaterialArrays&) = delete;
+    MaterialArrays& operator=(const MaterialArrays&) = delete;
+
+    //decode the image and reserve its place, thread safe and without OpenGL.
+    //null when the texture was already prepared by someone else (or can not be decoded)
+    std::shared_ptr<PendingLayer> prepare(const std::string& path){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!slots.insert(std::make_pair(path, MaterialSlot())).second)
+                return nullptr;
+        }
+
+        int width, height, channels;
+        stbi_set_flip_vertically_on_load_thread(true);
+        unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if(!data){
+            std::cout << "Failed to load material texture " << path << ": " << stbi_failure_reason() << std::endl;
+            return nullptr;
+        }
+
+        std::shared_ptr<PendingLayer> pending = std::make_shared<PendingLayer>();
+        pending->path = path;
+        pending->levels.resize(1);
+        std::vector<unsigned char>& pixels = pending->levels[0];
+        bool atlas = width <= MATERIAL_ATLAS_MAX_SIZE && height <= MATERIAL_ATLAS_MAX_SIZE;
+        int array = atlas ? 0 : -1;//-1: resampled to a layer of the first array
+        if(!atlas && width <= MATERIAL_LAYER_SIZE && height <= MATERIAL_LAYER_SIZE){
+            std::lock_guard<std::mutex> lock(mutex);
+            array = findArray(width, height);
+            if(array < 0)
+                std::cout << "No material array left for " << width << "x" << height << ", " << path << " is resampled" << std::endl;
+        }
+        if(atlas){
+            //the padding on the right and the top also rounds the rectangle up to a multiple of the last level
+            int alignment = 1 << MATERIAL_ATLAS_MAX_LOD;
+            int paddedWidth = (width + 2 * MATERIAL_ATLAS_PADDING + alignment - 1) / alignment * alignment;
+            int paddedHeight = (height + 2 * MATERIAL_ATLAS_PADDING + alignment - 1) / alignment * alignment;
+            pixels.resize((size_t) paddedWidth * paddedHeight * 4);
+            for(int y = 0; y < paddedHeight; y++){
+                int sourceY = wrap(y - MATERIAL_ATLAS_PADDING, height);
+                for(int x = 0; x < paddedWidth; x++){
+                    int sourceX = wrap(x - MATERIAL_ATLAS_PADDING, width);
+                    memcpy(&pixels[((size_t) y * paddedWidth + x) * 4], &data[((size_t) sourceY * width + sourceX) * 4], 4);
+                }
+            }
+            pending->width = paddedWidth;
+            pending->height = paddedHeight;
+        }else if(array >= 0){
+            pixels.assign(data, data + (size_t) width * height * 4);
+            pending->width = width;
+            pending->height = height;
+        }else{
+            array = 0;
+            pixels.resize((size_t) MATERIAL_LAYER_SIZE * MATERIAL_LAYER_SIZE * 4);
+            stbir_resize_uint8(data, width, height, 0, pixels.data(), MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE, 0, 4);
+            pending->width = pending->height = MATERIAL_LAYER_SIZE;
+        }
+        stbi_image_free(data);
+        buildLevels(*pending, atlas ? MATERIAL_ATLAS_MAX_LOD + 1 : mipLevels(pending->width, pending->height));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(atlas && !placeInAtlas(*pending, width, height))
+            return nullptr;
+        if(!atlas){
+            pending->slot.array = array;
+            pending->slot.layer = arrays[array].numLayers++;
+        }
+        return pending;
+    }
+
+    //write the levels of the texture in its layer and publish its slot, on the OpenGL thread
+    void upload(PendingLayer& pending){
+        int array = pending.slot.array;
+        reserveLayers(array, pending.slot.layer + 1);
+        GLState& state = GLState::instance();
+        state.bindTextureToEdit(GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT + array, GL_TEXTURE_2D_ARRAY, arrays[array].texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for(int level = 0; level < (int) pending.levels.size(); level++){
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, pending.x >> level, pending.y >> level, pending.slot.layer,
+                            std::max(1, pending.width >> level), std::max(1, pending.height >> level), 1,
+                            GL_RGBA, GL_UNSIGNED_BYTE, pending.levels[level].data());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        pending.levels.clear();
+        pending.levels.shrink_to_fit();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[pending.path] = pending.slot;
+        version++;
+    }
+
+    //layer -1 while the texture is not uploaded
+    MaterialSlot slot(const std::string& path){
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = slots.find(path);
+        return it == slots.end() ? MaterialSlot() : it->second;
+    }
+
+    //changes with every upload, the objects rebuild their table when it does
+    unsigned int getVersion(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return version;
+    }
+
+    //array i on the unit MATERIAL_TEXTURE_UNIT + i
+    void bind(){
+        for(int i = 0; i < MATERIAL_MAX_ARRAYS; i++)
+            GLState::instance().bindTexture(GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT + i, GL_TEXTURE_2D_ARRAY, arrays[i].texture);
+    }
+
+    //layers used in every array, atlas layers included
+    int layerCount(){
+        std::lock_guard<std::mutex> lock(mutex);
+        int layers = 0;
+        for(const LayerArray& array : arrays)
+            layers += array.numLayers;
+        return layers;
+    }
+
+private:
+    //an atlas layer and the skyline of stb_rect_pack on it
+    struct AtlasLayer {
+        int layer;
+        stbrp_context context;
+        std::vector<stbrp_node> nodes;
+    };
+
+    //the textures of one size, a size of 0 x 0 is not used yet
+    struct LayerArray {
+        int width = 0;
+        int height = 0;
+        int numLayers = 0;
+        //OpenGL thread only
+        GLuint texture = 0;
+        int capacity = 0;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, MaterialSlot> slots;
+    std::vector<std::unique_ptr<AtlasLayer>> atlases;//in the first array
+    LayerArray arrays[MATERIAL_MAX_ARRAYS];
+    unsigned int version = 0;
+
+    MaterialArrays(){
+        arrays[0].width = arrays[0].height = MATERIAL_LAYER_SIZE;
+    }
+
+    //the array of the size, a new one if there is room, -1 otherwise. The lock is held
+    int findArray(int width, int height){
+        for(int i = 0; i < MATERIAL_MAX_ARRAYS; i++){
+            if(arrays[i].width == width && arrays[i].height == height)
+                return i;
+            if(arrays[i].width == 0){
+                arrays[i].width = width;
+                arrays[i].height = height;
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    static int wrap(int value, int size){
+        return ((value % size) + size) % size;
+    }
+
+    //levels of the full chain, down to 1 x 1
+    static int mipLevels(int width, int height){
+        int levels = 1;
+        while((std::max(width, height) >> levels) > 0)
+            levels++;
+        return levels;
+    }
+
+    //reduce level 0 to the other levels, each from the previous one
+    static void buildLevels(PendingLayer& pending, int levels){
+        for(int level = 1; level < levels; level++){
+            int width = std::max(1, pending.width >> (level - 1)), height = std::max(1, pending.height >> (level - 1));
+            int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+            std::vector<unsigned char> next((size_t) nextWidth * nextHeight * 4);
+            stbir_resize_uint8(pending.levels[level - 1].data(), width, height, 0, next.data(), nextWidth, nextHeight, 0, 4);
+            pending.levels.push_back(std::move(next));
+        }
+    }
+
+    //first atlas layer with room for the padded image, a new one when none has
+    bool placeInAtlas(PendingLayer& pending, int width, int height){
+        stbrp_rect rect = {};
+        rect.w = pending.width;
+        rect.h = pending.height;
+        for(std::unique_ptr<AtlasLayer>& atlas : atlases){
+            stbrp_pack_rects(&atlas->context, &rect, 1);
+            if(rect.was_packed){
+                setAtlasSlot(pending, *atlas, rect, width, height);
+                return true;
+            }
+        }
+        std::unique_ptr<AtlasLayer> atlas(new AtlasLayer());
+        atlas->layer = arrays[0].numLayers++;
+        atlas->nodes.resize(MATERIAL_LAYER_SIZE);
+        stbrp_init_target(&atlas->context, MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE, atlas->nodes.data(), atlas->nodes.size());
+        stbrp_pack_rects(&atlas->context, &rect, 1);
+        if(!rect.was_packed)
+            return false;
+        setAtlasSlot(pending, *atlas, rect, width, height);
+        atlases.push_back(std::move(atlas));
+        return true;
+    }
+
+    void setAtlasSlot(PendingLayer& pending, const AtlasLayer& atlas, const stbrp_rect& rect, int width, int height){
+        pending.x = rect.x;
+        pending.y = rect.y;
+        pending.slot.layer = atlas.layer;
+        pending.slot.transform = glm::vec4(width, height, rect.x + MATERIAL_ATLAS_PADDING, rect.y + MATERIAL_ATLAS_PADDING) / (float) MATERIAL_LAYER_SIZE;
+        pending.slot.maxLod = MATERIAL_ATLAS_MAX_LOD;
+    }
+
+    //the array holds at least layers layers, the old ones are copied to the larger texture
+    void reserveLayers(int index, int layers){
+        LayerArray& array = arrays[index];
+        if(layers <= array.capacity)
+            return;
+        int newCapacity = array.capacity ? array.capacity : (index == 0 ? MATERIAL_FIRST_LAYERS : 1);
+        while(newCapacity < layers)
+            newCapacity *= 2;
+
+        GLState& state = GLState::instance();
+        GLenum unit = GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT + index;
+        GLuint newTexture;
+        glGenTextures(1, &newTexture);
+        state.bindTexture(unit, GL_TEXTURE_2D_ARRAY, newTexture);
+        int levels = mipLevels(array.width, array.height);
+        for(int level = 0; level < levels; level++){
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(1, array.width >> level), std::max(1, array.height >> level),
+                         newCapacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+        if(array.texture){
+            //every level of every old layer through a read framebuffer
+            GLint previousFramebuffer;
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer);
+            GLuint framebuffer;
+            glGenFramebuffers(1, &framebuffer);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+            for(int level = 0; level < levels; level++){
+                for(int layer = 0; layer < array.capacity; layer++){
+                    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, array.texture, level, layer);
+                    glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, 0, 0, std::max(1, array.width >> level), std::max(1, array.height >> level));
+                }
+            }
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFramebuffer);
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &array.texture);
+            state.forgetTexture(array.texture);
+        }
+        array.texture = newTexture;
+        array.capacity = newCapacity;
+        std::cout << "Material array " << index << ": " << array.capacity << " layers of " << array.width << "x" << array.height << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Binary cache of the flattened mesh data of an Object, so the Assimp import and its
+post-processing only run when the source file or the load flags change.
+
+Layout (little endian, every section 4 bytes aligned):
+    MeshCacheHeader
+    positions   numVertices * vec3
+    normals     numVertices * vec3
+    tangents    numVertices * vec3
+    textCoords  numVertices * vec2
+    indices     numIndices * uint32 (the full meshes, then the LOD levels)
+    meshes      numMeshes * MeshCacheEntry
+    lods        numLods * MeshCacheLod
+    materials   numMaterials * 3 strings (diffuse, normal, specular), each uint32 length + chars
+*/
+#define MESH_CACHE_MAGIC 0x48534d43 //"CMSH"
+#define MESH_CACHE_VERSION 4
+
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t loadFlags;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numMeshes;
+    uint32_t numMaterials;
+    uint32_t options;//Object load options changing the cached data (OBJECT_LOAD_OPTIMIZE, OBJECT_LOAD_LOD)
+    uint32_t numLods;
+    uint32_t padding;
+};
+
+struct MeshCacheEntry {
+    uint32_t numIndices;
+    uint32_t baseVertex;
+    uint32_t baseIndex;
+    uint32_t materialIndex;
+    //bounding box and sphere of the full mesh, in object space
+    float boundsMin[3];
+    float boundsMax[3];
+    float center[3];
+    float radius;
+};
+
+//a simplified level of a mesh, the levels of a mesh are stored from the finest to the coarsest
+struct MeshCacheLod {
+    uint32_t meshIndex;
+    uint32_t numIndices;
+    uint32_t baseIndex;
+    float error;
+};
+
+//64 bits FNV-1a hash, used to detect when a source file changed
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL){
+    const unsigned char* bytes = (const unsigned char*) data;
+    for(size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+//read only view of a whole file, memory mapped when the platform allows it
+class MappedFile {
+public:
+    MappedFile(){}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile(){
+        close();
+    }
+
+    bool open(const std::string& path){
+        close();
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        if(!file)
+            return false;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = (const unsigned char*) buffer.data();
+        length = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0){
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);//the mapping stays valid after closing the descriptor
+        if(mapping == MAP_FAILED)
+            return false;
+        bytes = (const unsigned char*) mapping;
+        length = st.st_size;
+        return true;
+#endif
+    }
+
+    void close(){
+#ifdef _WIN32
+        buffer.clear();
+#else
+        if(bytes)
+            munmap((void*) bytes, length);
+#endif
+        bytes = NULL;
+        length = 0;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = NULL;
+    size_t length = 0;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+};
+
+//returns 0 if the file can not be read
+uint64_t hashFile(const std::string& path){
+    MappedFile file;
+    if(!file.open(path))
+        return 0;
+    return hashBytes(file.data(), file.size());
+}
+
+//cache files live in PATH_TO_CACHE and are named after the source file and the cached load options,
+//so objects loaded with different options (the game, --cook, the benchmarks) do not overwrite each other
+std::string meshCachePath(const std::string& sourcePath, uint32_t options){
+    std::string::size_type slashIndex = sourcePath.find_last_of("/\\") + 1;
+    return std::string(PATH_TO_CACHE "/") + sourcePath.substr(slashIndex) + "." + std::to_string(options) + ".mesh";
+}
+
+//sequential reader returning pointers directly inside the mapped cache file
+class MeshCacheReader {
+public:
+    //fails if the file is missing, truncated or does not match the hash/flags/options/version
+    bool open(const std::string& path, uint64_t sourceHash, uint32_t loadFlags, uint32_t options){
+        if(!file.open(path) || file.size() < sizeof(MeshCacheHeader))
+            return false;
+        cursor = 0;
+        const MeshCacheHeader* h = read<MeshCacheHeader>(1);
+        if(h->magic != MESH_CACHE_MAGIC || h->version != MESH_CACHE_VERSION
+            || h->sourceHash != sourceHash || h->loadFlags != loadFlags || h->options != options)
+            return false;
+        header = *h;
+        return true;
+    }
+
+    //returns NULL when the file is too short
+    template<typename T>
+    const T* read(size_t count){
+        size_t bytes = sizeof(T) * count;
+        if(cursor + bytes > file.size())
+            return NULL;
+        const T* data = (const T*) (file.data() + cursor);
+        cursor += (bytes + 3) & ~(size_t)3;
+        return data;
+    }
+
+    bool readString(std::string& str){
+        const uint32_t* len = read<uint32_t>(1);
+        if(!len)
+            return false;
+        const char* chars = read<char>(*len);
+        if(!chars)
+            return false;
+        str.assign(chars, *len);
+        return true;
+    }
+
+    MeshCacheHeader header;
+
+private:
+    MappedFile file;
+    size_t cursor = 0;
+};
+
+//writes into a temporary file renamed on close, a reader never sees a half written cache
+class MeshCacheWriter {
+public:
+    //the header is a MeshCacheHeader, or the header of another binary format sharing this writer
+    template<typename Header>
+    bool open(const std::string& path, const Header& header){
+        this->path = path;
+        //unique per thread, the same file can be loaded by several workers at once
+        std::ostringstream tmp;
+        tmp << path << "." << std::this_thread::get_id() << ".tmp";
+        tmpPath = tmp.str();
+        out.open(tmpPath, std::ios::binary | std::ios::trunc);
+        if(!out)
+            return false;
+        write(&header, 1);
+        return true;
+    }
+
+    template<typename T>
+    void write(const T* data, size_t count){
+        size_t bytes = sizeof(T) * count;
+        if(bytes)
+            out.write((const char*) data, bytes);
+        static const char zeros[4] = {0};
+        out.write(zeros, ((bytes + 3) & ~(size_t)3) - bytes);
+    }
+
+    void writeString(const std::string& str){
+        uint32_t len = (uint32_t) str.size();
+        write(&len, 1);
+        write(str.data(), len);
+    }
+
+    bool close(){
+        out.close();
+#ifdef _WIN32
+        //rename does not replace an existing file on Windows, a stale cache would never be rewritten
+        if(out)
+            std::remove(path.c_str());
+#endif
+        if(!out || std::rename(tmpPath.c_str(), path.c_str()) != 0){
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::string path;
+    std::string tmpPath;
+    std::ofstream out;
+};
+
+#endif
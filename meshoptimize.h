@@ -0,0 +1,262 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+/* Index and vertex reordering run once after the import (the result is stored in the mesh cache):
+    optimizeVertexCache: Forsyth's "Linear-Speed Vertex Cache Optimisation", triangles are emitted
+        so the vertices they use are still in the post-transform cache,
+    optimizeOverdraw: the triangles are cut into clusters at the points where the cache efficiency allows it,
+        and the clusters facing outward from the mesh center are drawn first (Sander et al. "Fast Triangle Reordering"),
+    optimizeVertexFetch: the vertices are stored in the order of their first use by the indices.
+Indices are relative to the first vertex of the mesh, like in BasicMeshEntry.
+*/
+#define VERTEX_CACHE_SIZE 32 //size of the simulated post-transform cache
+#define OVERDRAW_THRESHOLD 1.05f //a cluster can be cut when its ACMR is at most 5% worse than the whole mesh
+#define OVERDRAW_MIN_CLUSTER 128 //triangles, every cluster boundary reloads the cache
+
+//Post-transform cache statistics of a triangle list, with a FIFO cache of VERTEX_CACHE_SIZE entries
+struct VertexCacheStats {
+    float acmr = 0;//average cache miss ratio: vertex shader invocations per triangle, 0.5 at best, 3 at worst
+    float atvr = 0;//average transformed vertex ratio: vertex shader invocations per vertex, 1 at best
+};
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t numIndices, size_t numVertices){
+    std::vector<unsigned int> timestamps(numVertices, 0);
+    unsigned int time = VERTEX_CACHE_SIZE + 1;
+    size_t misses = 0;
+    for(size_t i = 0; i < numIndices; i++){
+        //a FIFO cache keeps the vertex while less than VERTEX_CACHE_SIZE misses happened since it was loaded
+        if(time - timestamps[indices[i]] > VERTEX_CACHE_SIZE){
+            timestamps[indices[i]] = time++;
+            misses++;
+        }
+    }
+
+    VertexCacheStats stats;
+    if(numIndices > 0)
+        stats.acmr = (float) misses / (numIndices / 3);
+    if(numVertices > 0)
+        stats.atvr = (float) misses / numVertices;
+    return stats;
+}
+
+namespace forsyth {
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRI_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    float vertexScore(int cachePosition, unsigned int activeTriangles){
+        if(activeTriangles == 0)
+            return -1.0f;//not used anymore
+
+        float score = 0.0f;
+        if(cachePosition < 0){
+            //not in the cache
+        }else if(cachePosition < 3){
+            //used by the last triangle, fixed score so the next triangle does not reuse its three vertices
+            score = LAST_TRI_SCORE;
+        }else{
+            float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+        }
+        //favour the vertices with few triangles left, so lone triangles are not left behind
+        return score + VALENCE_BOOST_SCALE * std::pow((float) activeTriangles, -VALENCE_BOOST_POWER);
+    }
+}
+
+//reorder the triangles of a mesh for the post-transform cache, see forsyth::vertexScore
+void optimizeVertexCache(unsigned int* indices, size_t numIndices, size_t numVertices){
+    size_t numTriangles = numIndices / 3;
+    if(numTriangles == 0)
+        return;
+
+    //triangles of every vertex
+    std::vector<unsigned int> activeTriangles(numVertices, 0);
+    for(size_t i = 0; i < numIndices; i++)
+        activeTriangles[indices[i]]++;
+    std::vector<unsigned int> triangleOffsets(numVertices + 1, 0);
+    for(size_t v = 0; v < numVertices; v++)
+        triangleOffsets[v + 1] = triangleOffsets[v] + activeTriangles[v];
+    std::vector<unsigned int> vertexTriangles(numIndices);
+    std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for(size_t i = 0; i < numIndices; i++)
+        vertexTriangles[fill[indices[i]]++] = i / 3;
+
+    std::vector<int> cachePosition(numVertices, -1);
+    std::vector<float> vertexScores(numVertices);
+    for(size_t v = 0; v < numVertices; v++)
+        vertexScores[v] = forsyth::vertexScore(-1, activeTriangles[v]);
+
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<unsigned int> result;
+    result.reserve(numIndices);
+    std::vector<unsigned int> cache, nextCache;
+    cache.reserve(VERTEX_CACHE_SIZE + 3);
+    nextCache.reserve(VERTEX_CACHE_SIZE + 3);
+
+    size_t cursor = 0;//first triangle maybe not emitted, used when the cache has no candidate
+    long best = -1;
+    while(result.size() < numIndices){
+        if(best < 0){
+            while(emitted[cursor])
+                cursor++;
+            best = cursor;
+        }
+
+        unsigned int* triangle = &indices[best * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[best] = true;
+
+        //remove the triangle from the lists of its vertices
+        for(int k = 0; k < 3; k++){
+            unsigned int v = triangle[k];
+            unsigned int* begin = &vertexTriangles[triangleOffsets[v]];
+            unsigned int* end = begin + activeTriangles[v];
+            *std::find(begin, end, (unsigned int) best) = *(end - 1);
+            activeTriangles[v]--;
+        }
+
+        //LRU cache: the vertices of the triangle move to the front
+        nextCache.assign(triangle, triangle + 3);
+        for(unsigned int v : cache){
+            if(v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        }
+        for(size_t i = VERTEX_CACHE_SIZE; i < nextCache.size(); i++){
+            cachePosition[nextCache[i]] = -1;//evicted
+            vertexScores[nextCache[i]] = forsyth::vertexScore(-1, activeTriangles[nextCache[i]]);
+        }
+        if(nextCache.size() > VERTEX_CACHE_SIZE)
+            nextCache.resize(VERTEX_CACHE_SIZE);
+        cache.swap(nextCache);
+
+        //only the triangles of the vertices in the cache change score, the best next triangle is one of them
+        for(size_t i = 0; i < cache.size(); i++)
+            cachePosition[cache[i]] = i;
+        float bestScore = -1.0f;
+        best = -1;
+        for(unsigned int v : cache)
+            vertexScores[v] = forsyth::vertexScore(cachePosition[v], activeTriangles[v]);
+        for(unsigned int v : cache){
+            for(unsigned int j = 0; j < activeTriangles[v]; j++){
+                unsigned int t = vertexTriangles[triangleOffsets[v] + j];
+                float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                if(score > bestScore){
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+    }
+    std::copy(result.begin(), result.end(), indices);
+}
+
+//reorder the clusters of a cache optimized mesh so the outer surfaces are drawn first and hide the inner ones
+void optimizeOverdraw(unsigned int* indices, size_t numIndices, const glm::vec3* positions, size_t numVertices){
+    size_t numTriangles = numIndices / 3;
+    if(numTriangles < 2)
+        return;
+
+    float meshAcmr = analyzeVertexCache(indices, numIndices, numVertices).acmr;
+
+    //cut the triangle list into clusters, each cluster starts at a triangle
+    std::vector<unsigned int> clusterStarts;
+    std::vector<unsigned int> timestamps(numVertices, 0);
+    unsigned int time = VERTEX_CACHE_SIZE + 1;
+    size_t clusterMisses = 0;
+    for(size_t t = 0; t < numTriangles; t++){
+        unsigned int misses = 0;
+        for(int k = 0; k < 3; k++){
+            unsigned int v = indices[t * 3 + k];
+            if(time - timestamps[v] > VERTEX_CACHE_SIZE){
+                timestamps[v] = time++;
+                misses++;
+            }
+        }
+        //a triangle missing its 3 vertices starts a new strip anyway, cutting here costs nothing
+        size_t clusterTriangles = clusterStarts.empty() ? 0 : t - clusterStarts.back();
+        bool hardBoundary = misses == 3;
+        bool softBoundary = clusterTriangles >= OVERDRAW_MIN_CLUSTER && (float) clusterMisses / clusterTriangles <= meshAcmr * OVERDRAW_THRESHOLD;
+        if(clusterStarts.empty() || hardBoundary || softBoundary){
+            clusterStarts.push_back(t);
+            clusterMisses = 0;
+        }
+        clusterMisses += misses;
+    }
+    clusterStarts.push_back(numTriangles);
+    size_t numClusters = clusterStarts.size() - 1;
+    if(numClusters < 2)
+        return;
+
+    glm::vec3 meshCenter(0.0f);
+    for(size_t i = 0; i < numIndices; i++)
+        meshCenter += positions[indices[i]];
+    meshCenter /= (float) numIndices;
+
+    //clusters facing away from the center are in front of the others
+    std::vector<float> sortKeys(numClusters);
+    for(size_t c = 0; c < numClusters; c++){
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for(size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++){
+            const glm::vec3& p0 = positions[indices[t * 3]];
+            const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+            const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);//length is twice the area
+            float triangleArea = glm::length(n);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        if(area > 0.0f)
+            center /= area;
+        float normalLength = glm::length(normal);
+        sortKeys[c] = normalLength > 0.0f ? glm::dot(center - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    std::vector<unsigned int> order(numClusters);
+    for(size_t c = 0; c < numClusters; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b){ return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<unsigned int> result;
+    result.reserve(numIndices);
+    for(unsigned int c : order)
+        result.insert(result.end(), indices + clusterStarts[c] * 3, indices + clusterStarts[c + 1] * 3);
+    std::copy(result.begin(), result.end(), indices);
+}
+
+//returns remap[oldVertex] = newVertex, vertices are numbered by their first use, the unused ones at the end
+std::vector<unsigned int> optimizeVertexFetch(unsigned int* indices, size_t numIndices, size_t numVertices){
+    const unsigned int unused = 0xFFFFFFFF;
+    std::vector<unsigned int> remap(numVertices, unused);
+    unsigned int next = 0;
+    for(size_t i = 0; i < numIndices; i++){
+        if(remap[indices[i]] == unused)
+            remap[indices[i]] = next++;
+        indices[i] = remap[indices[i]];
+    }
+    for(size_t v = 0; v < numVertices; v++){
+        if(remap[v] == unused)
+            remap[v] = next++;
+    }
+    return remap;
+}
+
+//apply the result of optimizeVertexFetch to one vertex attribute
+template<typename T>
+void remapVertices(T* vertices, const std::vector<unsigned int>& remap){
+    std::vector<T> copy(vertices, vertices + remap.size());
+    for(size_t v = 0; v < remap.size(); v++)
+        vertices[remap[v]] = copy[v];
+}
+
+#endif
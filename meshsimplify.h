@@ -0,0 +1,200 @@
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+/* Quadric error simplification (Garland and Heckbert "Surface Simplification Using Quadric Error Metrics")
+used to build the LOD levels of a mesh. Edges are collapsed onto one of their two vertices, so a simplified
+mesh only has new indices and keeps using the vertex buffer of the full mesh.
+Vertices on an open edge are locked: mesh borders and texture/normal seams (split vertices) do not move,
+so the levels do not open holes or stretch the textures.
+*/
+
+//symmetric 4x4 matrix, sum of the squared distances to a set of planes
+struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0;
+    double b2 = 0, bc = 0, bd = 0;
+    double c2 = 0, cd = 0;
+    double d2 = 0;
+
+    void addPlane(const glm::vec3& n, float d){
+        a2 += n.x * n.x; ab += n.x * n.y; ac += n.x * n.z; ad += n.x * d;
+        b2 += n.y * n.y; bc += n.y * n.z; bd += n.y * d;
+        c2 += n.z * n.z; cd += n.z * d;
+        d2 += d * d;
+    }
+
+    void add(const Quadric& q){
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    double error(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                 + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                 + c2 * z * z + 2 * cd * z
+                 + d2;
+        return std::max(e, 0.0);
+    }
+};
+
+//vertices used by an edge with no opposite edge (a border or a seam)
+std::vector<bool> findLockedVertices(const unsigned int* indices, size_t numIndices, size_t numVertices){
+    std::vector<std::pair<unsigned int, unsigned int>> edges;
+    edges.reserve(numIndices);
+    for(size_t i = 0; i < numIndices; i += 3){
+        for(int k = 0; k < 3; k++)
+            edges.push_back(std::make_pair(indices[i + k], indices[i + (k + 1) % 3]));
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> locked(numVertices, false);
+    for(auto& edge : edges){
+        if(!std::binary_search(edges.begin(), edges.end(), std::make_pair(edge.second, edge.first))){
+            locked[edge.first] = true;
+            locked[edge.second] = true;
+        }
+    }
+    return locked;
+}
+
+/* Returns the indices of a simplified copy with at most targetIndices indices, or the closest it can reach.
+error is set to the largest collapse error, an estimate of the distance between the two surfaces.
+*/
+std::vector<unsigned int> simplifyMesh(const unsigned int* indices, size_t numIndices,
+                                       const glm::vec3* positions, size_t numVertices,
+                                       size_t targetIndices, float& error){
+    std::vector<unsigned int> result(indices, indices + numIndices);
+    std::vector<bool> locked = findLockedVertices(indices, numIndices, numVertices);
+    double maxError = 0.0;
+
+    std::vector<Quadric> quadrics(numVertices);
+    for(size_t i = 0; i < numIndices; i += 3){
+        const glm::vec3& p0 = positions[indices[i]];
+        glm::vec3 n = glm::cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+        float length = glm::length(n);
+        if(length == 0.0f)
+            continue;
+        n /= length;
+        float d = -glm::dot(n, p0);
+        for(int k = 0; k < 3; k++)
+            quadrics[indices[i + k]].addPlane(n, d);
+    }
+
+    struct Collapse {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> remap(numVertices);
+    std::vector<bool> touched(numVertices);
+    std::vector<unsigned int> triangleOffsets(numVertices + 1);
+    std::vector<unsigned int> vertexTriangles;
+
+    //every pass collapses the cheapest edges that do not share a neighbourhood, then rebuilds the lists
+    while(result.size() > targetIndices){
+        collapses.clear();
+        for(size_t i = 0; i < result.size(); i += 3){
+            for(int k = 0; k < 3; k++){
+                unsigned int from = result[i + k];
+                unsigned int to = result[i + (k + 1) % 3];
+                if(!locked[from]){
+                    Quadric q = quadrics[from];
+                    q.add(quadrics[to]);
+                    collapses.push_back({from, to, q.error(positions[to])});
+                }
+                if(!locked[to]){
+                    Quadric q = quadrics[to];
+                    q.add(quadrics[from]);
+                    collapses.push_back({to, from, q.error(positions[from])});
+                }
+            }
+        }
+        if(collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b){ return a.cost < b.cost; });
+
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for(unsigned int v : result)
+            triangleOffsets[v + 1]++;
+        for(size_t v = 0; v < numVertices; v++)
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        vertexTriangles.resize(result.size());
+        std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for(size_t i = 0; i < result.size(); i++)
+            vertexTriangles[fill[result[i]]++] = i / 3;
+
+        for(size_t v = 0; v < numVertices; v++)
+            remap[v] = v;
+        std::fill(touched.begin(), touched.end(), false);
+
+        size_t removedIndices = 0;
+        size_t passCollapses = 0;
+        for(const Collapse& collapse : collapses){
+            if(result.size() - removedIndices <= targetIndices)
+                break;
+            if(touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            //the triangles moved by the collapse must not flip
+            bool flips = false;
+            size_t removedTriangles = 0;
+            const glm::vec3& target = positions[collapse.to];
+            for(unsigned int j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1] && !flips; j++){
+                const unsigned int* triangle = &result[vertexTriangles[j] * 3];
+                if(triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to){
+                    removedTriangles++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for(int k = 0; k < 3; k++){
+                    p[k] = positions[triangle[k]];
+                    q[k] = triangle[k] == collapse.from ? target : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips = glm::dot(before, after) <= 0.0f;
+            }
+            if(flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            for(unsigned int j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1]; j++){
+                const unsigned int* triangle = &result[vertexTriangles[j] * 3];
+                for(int k = 0; k < 3; k++)
+                    touched[triangle[k]] = true;
+            }
+            removedIndices += removedTriangles * 3;
+            maxError = std::max(maxError, collapse.cost);
+            passCollapses++;
+        }
+        if(passCollapses == 0)
+            break;
+
+        //apply the collapses and drop the degenerate triangles
+        size_t kept = 0;
+        for(size_t i = 0; i < result.size(); i += 3){
+            unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if(a == b || b == c || a == c)
+                continue;
+            result[kept++] = a;
+            result[kept++] = b;
+            result[kept++] = c;
+        }
+        result.resize(kept);
+    }
+
+    error = (float) std::sqrt(maxError);
+    return result;
+}
+
+#endif
@@ -2,13 +2,27 @@
 #define OBJECT_H
 
 #include <vector>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
 #include <assimp/Importer.hpp> 
 #include <assimp/scene.h>           
 #include <assimp/postprocess.h>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include "texture.h"
 #include "shader.h"
+#include "meshcache.h"
+#include "meshoptimize.h"
+#include "meshsimplify.h"
+#include "glstate.h"
+#include "frustum.h"
+#include "occlusion.h"
+#include "gpuculling.h"
+#include "materialarrays.h"
 
 #define ARRAY_SIZE_IN_ELEMENTS(a) (sizeof(a)/sizeof(a[0]))
 
@@ -16,24 +30,97 @@
 #define ASSIMP_LOAD_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals| aiProcess_JoinIdenticalVertices | aiProcess_CalcTangentSpace)
 #define INVALID_MATERIAL 0xFFFFFFFF
 
+//options of the Object constructor
+#define OBJECT_LOAD_DEFAULT 0
+#define OBJECT_LOAD_NO_CACHE 0x1 //always import with Assimp and do not write the mesh cache
+#define OBJECT_LOAD_OPTIMIZE 0x2 //reorder the triangles and vertices of every mesh after the import, see meshoptimize.h
+#define OBJECT_LOAD_LOD 0x4 //build simplified levels of every mesh after the import, see meshsimplify.h
+#define OBJECT_LOAD_PACK_MATERIALS 0x8 //read the textures from the MaterialArrays, see materialarrays.h (not cached)
+
+/* Level of detail: every level has about half the triangles of the previous one.
+draw(model, view) uses the coarsest level whose error projected on the screen is below LOD_PIXEL_ERROR,
+a coarser level is only taken when its error is below LOD_PIXEL_ERROR * LOD_HYSTERESIS to avoid popping back and forth.
+*/
+#define LOD_MAX_LEVELS 4 //full mesh included
+#define LOD_MIN_TRIANGLES 64 //smaller meshes are not simplified further
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS 0.75f
+
+//occluders of the software occlusion culling, see occlusion.h
+#define OCCLUDER_MIN_RADIUS 5.0f //smaller meshes hide too little to be worth rasterizing
+#define OCCLUDER_MAX_ERROR 0.02f //of the radius, coarser levels cover more than the mesh
+#define OCCLUDER_MAX_TRIANGLES 512
+
 /* Variables in vertex shader should be defined as:
 layout(location = 0) in vec3 position; 
 layout(location = 1) in vec3 normal; 
 layout(location = 2) in vec2 textureCoord; 
 layout(location = 3) in vec3 tangent; 
+layout(location = 4) in uint material; //only with packedMaterials
 */
 #define POSITION_LOC 0
 #define NORMAL_LOC 1
 #define TEXTURECOORD_LOC 2
 #define TANGENT_LOC 3
+#define MATERIAL_LOC 4
+
+/* Vertex formats accepted by Object::makeObject
+VERTEX_FORMAT_FLOAT: one GL_FLOAT buffer per attribute and 32 bits indices, 44 bytes per vertex
+VERTEX_FORMAT_PACKED: a single interleaved buffer of PackedVertex, 20 or 24 bytes per vertex.
+    normals and tangents are 10_10_10_2 snorm, texture coordinates half floats,
+    tangents are dropped when no material has a normal map,
+    indices are 16 bits for every mesh with less than 65536 vertices
+*/
+enum VertexFormat {
+    VERTEX_FORMAT_FLOAT,
+    VERTEX_FORMAT_PACKED
+};
+
+struct PackedVertex {
+    glm::vec3 position;
+    uint32_t normal;
+    uint32_t textCoord;
+    uint32_t tangent;//not uploaded when the object has no normal map
+};
+
+//camera information needed to select the LOD levels and cull the meshes out of the screen
+struct LodView {
+    glm::vec3 cameraPosition;
+    float pixelScale;//pixels covered by one unit at distance 1
+    glm::mat4 viewProjection;
+    const OcclusionBuffer* occlusion = nullptr;//occluders of the frame, rasterized before the draws
+    GpuCulling* gpuCulling = nullptr;//when set the meshes are culled on the GPU and drawn by indirect draws
+};
+
+LodView makeLodView(const glm::vec3& cameraPosition, const glm::mat4& projection, const glm::mat4& view, int screenHeight){
+    //projection[1][1] is 1 / tan(fov / 2)
+    LodView lodView = {cameraPosition, projection[1][1] * screenHeight * 0.5f, projection * view};
+    return lodView;
+}
+
+//meshes drawn and skipped by the frustum culling
+struct CullCounters {
+    unsigned int visible = 0;
+    unsigned int culled = 0;//out of the frustum
+    unsigned int occluded = 0;//in the frustum, hidden by the occluders
+    unsigned int gpuTested = 0;//handed to the GPU culling, how many it culls is not read back
+};
+
+//full paths of the textures of a material, empty when the material has none
+struct MaterialPaths {
+    std::string diffuse;
+    std::string normal;
+    std::string specular;
+};
 
 class Material {
 
  public:
 
-    Texture* pDiffuse = NULL;
-    Texture* pNormal = NULL;
-    Texture* pSpecularExponent = NULL;
+    //shared with the other materials using the same image, see TextureCache
+    std::shared_ptr<Texture> pDiffuse;
+    std::shared_ptr<Texture> pNormal;
+    std::shared_ptr<Texture> pSpecularExponent;
 };
 
 //class based on tutorial "Loading Models Using Assimp": https://www.youtube.com/watch?v=sP_kiODC25Q
@@ -46,7 +133,16 @@ public:
         TEXCOORD_VB  = 2,
         NORMAL_VB    = 3,
         TANGENT_VB    = 4,
-        NUM_BUFFERS  = 5
+        MATERIAL_VB   = 5,
+        NUM_BUFFERS  = 6
+    };
+
+    //a simplified copy of a mesh, its indices use the same vertices
+    struct MeshLod {
+        unsigned int numIndices;
+        unsigned int baseIndex;
+        float error;//distance to the full mesh in object space
+        size_t indexOffset;//set by makeObject
     };
 
     struct BasicMeshEntry {
@@ -55,15 +151,43 @@ public:
             baseVertex = 0;
             baseIndex = 0;
             materialIndex = INVALID_MATERIAL;
+            indexType = GL_UNSIGNED_INT;
+            indexOffset = 0;
+            boundsMin = boundsMax = center = glm::vec3(0.0f);
+            radius = 0;
+            currentLod = 0;
+            occluderLevel = -1;
         }
         unsigned int numIndices;
         unsigned int baseVertex;
         unsigned int baseIndex;
         unsigned int materialIndex;
+        //where the indices of this mesh are in the index buffer, set by makeObject
+        GLenum indexType;
+        size_t indexOffset;
+        //levels coarser than the full mesh, from the finest to the coarsest
+        std::vector<MeshLod> lods;
+        //bounding box and sphere in object space, the sphere is centered on the box
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        glm::vec3 center;
+        float radius;
+        unsigned int currentLod;//level drawn last frame, 0 is the full mesh
+        int occluderLevel;//level rasterized by the occlusion culling, -1 when the mesh is not an occluder
+    };
+
+    //consecutive meshes of drawOrder sharing a material and an index type, drawn by one glMultiDrawElementsBaseVertex
+    struct DrawBatch {
+        unsigned int materialIndex;//first material of the batch, the others have the same textures
+        GLenum indexType;
+        unsigned int firstMesh;//in drawOrder
+        unsigned int numMeshes;
     };
     
-    GLuint VAO;
+    std::string path;
+    GLuint VAO = 0;
     GLuint buffers[NUM_BUFFERS] = {0};
+    GLuint cullBuffers[NUM_CULL_BUFFERS] = {0};//meshes, levels and commands of the GPU culling, made by its first draw
     std::vector<BasicMeshEntry> meshes;
 
     std::vector<glm::vec3> positions;
@@ -72,102 +196,590 @@ public:
     std::vector<glm::vec3> tangents;
 	std::vector<unsigned int > indices;
 	std::vector<Material> materials;
+    std::vector<MaterialPaths> materialPaths;
+    //the textures are layers of the MaterialArrays selected per vertex, the Material textures stay null
+    bool packedMaterials = false;
+    //mesh indices sorted by material, built with the buffers
+    std::vector<unsigned int> drawOrder;
+    std::vector<DrawBatch> drawBatches;
 
-    Object(const char* path) {
+    //draw calls issued by every Object since the last resetDrawCalls
+    static unsigned int& drawCalls(){ static unsigned int count = 0; return count; }
+    static void resetDrawCalls(){
+        drawCalls() = 0;
+    }
 
-        std::cout << "Loading object" << path << std::endl;
-        Assimp::Importer importer;
+    //meshes tested by the frustum culling of draw(model, view) since the last resetCullCounters
+    static CullCounters& cullCounters(){ static CullCounters counters; return counters; }
+    static void resetCullCounters(){
+        cullCounters() = CullCounters();
+    }
 
-        const aiScene* pScene = importer.ReadFile(path, ASSIMP_LOAD_FLAGS);
+    //empty object, filled later by load (used by the asset loader)
+    Object(){}
 
-        if(pScene){
+    Object(const char* path, unsigned int loadOptions = OBJECT_LOAD_DEFAULT) {
+        load(path, loadOptions);
+    }
 
-            meshes.resize(pScene->mNumMeshes);
-            materials.resize(pScene->mNumMaterials);
+    //CPU side of the loading (import or mesh cache), does not need an OpenGL context
+    void load(const char* path, unsigned int loadOptions = OBJECT_LOAD_DEFAULT) {
 
-            //find total number of vertices/indices over all meshes to reserve space
-            unsigned int numVertices = 0;
-            unsigned int numIndices = 0;
+        std::cout << "Loading object" << path << std::endl;
+        this->path = path;
+        packedMaterials = loadOptions & OBJECT_LOAD_PACK_MATERIALS;
+        bool useCache = !(loadOptions & OBJECT_LOAD_NO_CACHE);
+        uint64_t sourceHash = useCache ? hashFile(path) : 0;
+        //the optimized meshes are cached separately from the raw import
+        uint32_t cacheOptions = loadOptions & (OBJECT_LOAD_OPTIMIZE | OBJECT_LOAD_LOD);
 
-            countVerticesAndIndices(pScene, numVertices, numIndices);
+        if(!useCache || !loadFromCache(path, sourceHash, cacheOptions)){
+            if(!importFile(path))
+                return;
+            if(loadOptions & OBJECT_LOAD_OPTIMIZE)
+                optimizeMeshes();
+            if(loadOptions & OBJECT_LOAD_LOD)
+                generateLods();
+            computeBounds();
+            if(useCache)
+                saveToCache(path, sourceHash, cacheOptions);
+        }
+    }
 
-            positions.reserve(numVertices);
-            materials.reserve(numVertices);
-            normals.reserve(numVertices);
-            tangents.reserve(numVertices);
-            indices.reserve(numIndices);
+    //vertex cache, overdraw and vertex fetch optimization of every mesh, prints the ACMR/ATVR before and after
+    void optimizeMeshes(){
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            BasicMeshEntry& mesh = meshes[i];
+            size_t numVertices = meshVertexCount(i);
+            unsigned int* meshIndices = &indices[mesh.baseIndex];
+            const glm::vec3* meshPositions = &positions[mesh.baseVertex];
 
-            //populate buffers for every meshes
-            for(unsigned int meshIdx =0; meshIdx < meshes.size(); meshIdx++){
-                const aiMesh* paiMesh = pScene->mMeshes[meshIdx];
-                const aiVector3D zero3D(0.0f, 0.0f, 0.0f);
+            VertexCacheStats before = analyzeVertexCache(meshIndices, mesh.numIndices, numVertices);
+            optimizeVertexCache(meshIndices, mesh.numIndices, numVertices);
+            optimizeOverdraw(meshIndices, mesh.numIndices, meshPositions, numVertices);
+            std::vector<unsigned int> remap = optimizeVertexFetch(meshIndices, mesh.numIndices, numVertices);
+            remapVertices(&positions[mesh.baseVertex], remap);
+            remapVertices(&normals[mesh.baseVertex], remap);
+            remapVertices(&tangents[mesh.baseVertex], remap);
+            remapVertices(&textCoords[mesh.baseVertex], remap);
+            VertexCacheStats after = analyzeVertexCache(meshIndices, mesh.numIndices, numVertices);
 
-                //populate vertex attribute buffers for this mesh
-                for(unsigned int i = 0; i < paiMesh->mNumVertices; i++){
-                    const aiVector3D& pPos = paiMesh->mVertices[i];
-                    positions.push_back(glm::vec3(pPos.x,pPos.y,pPos.z));
+            std::cout << "Optimized mesh " << i << " of " << path << " (" << mesh.numIndices / 3 << " triangles): ACMR "
+                      << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+        }
+    }
 
-                    const aiVector3D& pNormal = paiMesh->mNormals[i];
-                    normals.push_back(glm::vec3(pNormal.x,pNormal.y,pNormal.z));
+    //simplify every mesh into up to LOD_MAX_LEVELS - 1 coarser levels, their indices are appended after the full meshes
+    void generateLods(){
+        size_t fullTriangles = indices.size() / 3;
+        std::vector<size_t> levelTriangles(LOD_MAX_LEVELS, 0);
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            BasicMeshEntry& mesh = meshes[i];
+            size_t numVertices = meshVertexCount(i);
+            const glm::vec3* meshPositions = &positions[mesh.baseVertex];
+            std::vector<unsigned int> previous(indices.begin() + mesh.baseIndex, indices.begin() + mesh.baseIndex + mesh.numIndices);
+            levelTriangles[0] += previous.size() / 3;
+            float previousError = 0.0f;
 
-                    
-                    if(paiMesh->HasTangentsAndBitangents()){
-                        const aiVector3D& pTangent = paiMesh->mTangents[i];
-                        tangents.push_back(glm::vec3(pTangent.x,pTangent.y,pTangent.z));
-                    }
-                    
+            mesh.lods.clear();
+            for(unsigned int level = 1; level < LOD_MAX_LEVELS && previous.size() / 3 >= LOD_MIN_TRIANGLES; level++){
+                float error;
+                size_t target = previous.size() / 6 * 3;
+                std::vector<unsigned int> simplified = simplifyMesh(previous.data(), previous.size(), meshPositions, numVertices, target, error);
+                if(simplified.size() > previous.size() * 3 / 4)
+                    break;//the borders and seams are locked, not worth a level
 
-                    const aiVector3D& pTexture = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][i] : zero3D;
-                    textCoords.push_back(glm::vec2(pTexture.x,pTexture.y));
-                }
+                optimizeVertexCache(simplified.data(), simplified.size(), numVertices);
+                MeshLod lod;
+                lod.numIndices = simplified.size();
+                lod.baseIndex = indices.size();
+                lod.error = std::max(error, previousError);
+                lod.indexOffset = 0;
+                mesh.lods.push_back(lod);
+                indices.insert(indices.end(), simplified.begin(), simplified.end());
+                levelTriangles[level] += simplified.size() / 3;
 
-                //populate index buffers for this mesh
-                for(unsigned int i = 0; i < paiMesh->mNumFaces; i++){
-                    const aiFace& face = paiMesh->mFaces[i];
-                    assert(face.mNumIndices == 3);
-                    indices.push_back(face.mIndices[0]);
-                    indices.push_back(face.mIndices[1]);
-                    indices.push_back(face.mIndices[2]);
-                }
+                previous.swap(simplified);
+                previousError = lod.error;
             }
+            //meshes with less levels draw their coarsest one in the next levels
+            for(unsigned int level = mesh.lods.size() + 1; level < LOD_MAX_LEVELS; level++)
+                levelTriangles[level] += previous.size() / 3;
+        }
 
-            //now, init all materials of this scene
-            initMaterials(pScene, path);
+        std::cout << "LOD levels of " << path << ":";
+        for(unsigned int level = 0; level < LOD_MAX_LEVELS; level++)
+            std::cout << " " << levelTriangles[level];
+        std::cout << " triangles (" << fullTriangles << " full)" << std::endl;
+    }
 
+    //the vertices of a mesh are stored between its baseVertex and the baseVertex of the next one
+    size_t meshVertexCount(unsigned int meshIndex){
+        size_t end = meshIndex + 1 < meshes.size() ? meshes[meshIndex + 1].baseVertex : positions.size();
+        return end - meshes[meshIndex].baseVertex;
+    }
 
-        }else{
-            std::cerr << "Error importing file " << path << ": " << importer.GetErrorString() << std::endl;
+    //bounding box and sphere of every mesh, used to select the LOD levels and for the frustum culling.
+    //they are stored in the mesh cache, this only runs after an import
+    void computeBounds(){
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            BasicMeshEntry& mesh = meshes[i];
+            size_t numVertices = meshVertexCount(i);
+            if(numVertices == 0)
+                continue;
+            glm::vec3 minimum = positions[mesh.baseVertex], maximum = minimum;
+            for(size_t v = mesh.baseVertex; v < mesh.baseVertex + numVertices; v++){
+                minimum = glm::min(minimum, positions[v]);
+                maximum = glm::max(maximum, positions[v]);
+            }
+            mesh.boundsMin = minimum;
+            mesh.boundsMax = maximum;
+            mesh.center = (minimum + maximum) * 0.5f;
+            mesh.radius = 0.0f;
+            for(size_t v = mesh.baseVertex; v < mesh.baseVertex + numVertices; v++)
+                mesh.radius = std::max(mesh.radius, glm::length(positions[v] - mesh.center));
+        }
+    }
+
+    void makeObject(Shader& shader, VertexFormat format = VERTEX_FORMAT_FLOAT) {
+
+        //textures are only loaded now, the constructor does not need an OpenGL context
+        createMaterials();
+        loadMaterials();
+        makeBuffers(shader, format);
+    }
+
+    //create the Texture of every material without reading the images, can run on any thread.
+    //packed materials have no Texture, their images are added to the MaterialArrays by the loader
+    void createMaterials(){
+        if(packedMaterials && materials.size() > MATERIAL_TABLE_SIZE){
+            std::cout << path << " has " << materials.size() << " materials, more than a MaterialTable: not packed" << std::endl;
+            packedMaterials = false;
+        }
+        if(packedMaterials)
+            return;
+        for(unsigned int i = 0; i < materialPaths.size(); i ++){
+            if(!materials[i].pDiffuse)
+                materials[i].pDiffuse = createTexture(materialPaths[i].diffuse, "diffuse");
+            if(!materials[i].pNormal)
+                materials[i].pNormal = createTexture(materialPaths[i].normal, "normal");
+            if(!materials[i].pSpecularExponent)
+                materials[i].pSpecularExponent = createTexture(materialPaths[i].specular, "specular");
+        }
+    }
+
+    //decode and upload every texture not loaded yet, on the OpenGL thread
+    void loadMaterials(){
+        //loop over every material
+        for(unsigned int i = 0; i < materials.size(); i ++){
+            loadTexture(materials[i].pDiffuse, GL_TEXTURE0, "diffuse", i);
+            loadTexture(materials[i].pNormal, GL_TEXTURE1, "normal", i);
+            loadTexture(materials[i].pSpecularExponent, GL_TEXTURE2, "specular", i);
         }
     }
 
-    void makeObject(Shader shader) {
+    //OpenGL side of makeObject: vertex array, buffers and uniform locations
+    void makeBuffers(Shader& shader, VertexFormat format = VERTEX_FORMAT_FLOAT) {
 
 		//Create the VAO
         glGenVertexArrays(1, &VAO);
-        glBindVertexArray(VAO);
+        GLState::instance().bindVertexArray(VAO);
 
         //Create the buffers containing vertices attributes
         glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(buffers), buffers);
 
-        
-        glBindBuffer(GL_ARRAY_BUFFER, buffers[POS_VB]);
+        if(format == VERTEX_FORMAT_PACKED)
+            uploadPackedVertices();
+        else
+            uploadFloatVertices();
+        if(packedMaterials)
+            uploadMaterialIndices();
+
+        //unbind VAO
+        GLState::instance().bindVertexArray(0);
+
+		//unbind the buffers
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        this->hasTextureLocation = shader.getUniformLocation("hasTexture");
+        this->hasSpecularMapLocation = shader.getUniformLocation("hasSpecularMap");
+        this->hasNormalMapLocation = shader.getUniformLocation("hasNormalMap");
+        this->packedMaterialsLocation = shader.getUniformLocation("packedMaterials");
+        buildDrawList();
+        buildCullBounds();
+        selectOccluders();
+    }
+
+    //sort the meshes by material and merge the runs using the same textures and index type into batches
+    void buildDrawList(){
+        //materials with the same textures (shared by TextureCache) are the same material for the draw list
+        std::vector<unsigned int> materialKeys(materials.size());
+        for(unsigned int i = 0; i < materials.size(); i++){
+            materialKeys[i] = i;
+            for(unsigned int j = 0; j < i; j++){
+                if(materials[j].pDiffuse == materials[i].pDiffuse && materials[j].pNormal == materials[i].pNormal
+                    && materials[j].pSpecularExponent == materials[i].pSpecularExponent){
+                    materialKeys[i] = materialKeys[j];
+                    break;
+                }
+            }
+        }
+        //packed materials are selected per vertex, every mesh can share a batch
+        auto materialKey = [&](const BasicMeshEntry& mesh){
+            if(packedMaterials)
+                return 0u;
+            return mesh.materialIndex < materialKeys.size() ? materialKeys[mesh.materialIndex] : mesh.materialIndex;
+        };
+
+        drawOrder.resize(meshes.size());
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            drawOrder[i] = i;
+        std::stable_sort(drawOrder.begin(), drawOrder.end(), [&](unsigned int a, unsigned int b){
+            unsigned int keyA = materialKey(meshes[a]), keyB = materialKey(meshes[b]);
+            if(keyA != keyB)
+                return keyA < keyB;
+            return meshes[a].indexType < meshes[b].indexType;
+        });
+
+        drawBatches.clear();
+        for(unsigned int i = 0; i < drawOrder.size(); i++){
+            const BasicMeshEntry& mesh = meshes[drawOrder[i]];
+            if(!drawBatches.empty()){
+                DrawBatch& last = drawBatches.back();
+                if(materialKey(meshes[drawOrder[last.firstMesh]]) == materialKey(mesh) && last.indexType == mesh.indexType){
+                    last.numMeshes++;
+                    continue;
+                }
+            }
+            drawBatches.push_back({mesh.materialIndex, mesh.indexType, i, 1});
+        }
+        drawCounts.reserve(meshes.size());
+        drawOffsets.reserve(meshes.size());
+        drawBaseVertices.reserve(meshes.size());
+
+        std::cout << "Draw list of " << path << ": " << meshes.size() << " draw calls -> " << drawBatches.size() << std::endl;
+    }
+
+
+    //delete the OpenGL buffers, the CPU data is kept
+    void unload(){
+        if(!VAO)
+            return;
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(ARRAY_SIZE_IN_ELEMENTS(buffers), buffers);
+        GLState::instance().forgetVertexArray(VAO);
+        if(materialTable){
+            glDeleteBuffers(1, &materialTable);
+            GLState::instance().forgetBuffer(materialTable);
+            materialTable = 0;
+        }
+        for(GLuint buffer : buffers)
+            GLState::instance().forgetBuffer(buffer);
+        if(cullBuffers[0]){
+            glDeleteBuffers(NUM_CULL_BUFFERS, cullBuffers);
+            for(GLuint buffer : cullBuffers)
+                GLState::instance().forgetBuffer(buffer);
+        }
+        VAO = 0;
+        memset(buffers, 0, sizeof(buffers));
+        memset(cullBuffers, 0, sizeof(cullBuffers));
+    }
+
+	//draw the full meshes
+	void draw() {
+        if(!VAO)//not uploaded yet
+            return;
+
+		//the VAO stays bound, the next object binding the same one skips the call
+		GLState::instance().bindVertexArray(this->VAO);
+		for(const DrawBatch& batch : drawBatches)
+            drawBatch(batch, false);
+	}
+
+	//draw the full meshes instanceCount times without binding the materials, the shader reads per instance attributes
+	void drawInstanced(GLsizei instanceCount) {
+        if(!VAO || instanceCount == 0)
+            return;
+
+		GLState::instance().bindVertexArray(this->VAO);
+		for(const BasicMeshEntry& mesh : meshes){
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.numIndices, mesh.indexType, (void*)mesh.indexOffset, instanceCount, mesh.baseVertex);
+            drawCalls()++;
+        }
+	}
+
+	//queue the occluders of this object, the closest and largest first
+	void addOccluders(OcclusionBuffer& occlusion, const glm::mat4& model, const glm::vec3& cameraPosition) const {
+        float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+        for(const BasicMeshEntry& mesh : meshes){
+            if(mesh.occluderLevel < 0)
+                continue;
+            unsigned int baseIndex = mesh.occluderLevel == 0 ? mesh.baseIndex : mesh.lods[mesh.occluderLevel - 1].baseIndex;
+            unsigned int numIndices = mesh.occluderLevel == 0 ? mesh.numIndices : mesh.lods[mesh.occluderLevel - 1].numIndices;
+            float distance = glm::length(glm::vec3(model * glm::vec4(mesh.center, 1.0f)) - cameraPosition);
+            occlusion.addOccluder(positions.data(), &indices[baseIndex], numIndices, mesh.baseVertex, model,
+                                  mesh.radius * scale / std::max(distance, 1.0f));
+        }
+	}
+
+	//draw the meshes in the view frustum at the LOD level matching their size on the screen, model is the matrix given to the shader
+	void draw(const glm::mat4& model, const LodView& view) {
+        if(!VAO)//not uploaded yet
+            return;
+        if(view.gpuCulling){
+            drawIndirect(model, view);
+            return;
+        }
+
+        size_t inFrustum = cullBounds(makeFrustum(view.viewProjection * model), cullBoundsSoA, meshVisible.data());
+        size_t numVisible = inFrustum;
+        if(view.occlusion && inFrustum){
+            glm::mat4 modelViewProjection = view.viewProjection * model;
+            for(unsigned int i = 0; i < meshes.size(); i++){
+                if(meshVisible[i] && !view.occlusion->isVisible(modelViewProjection, meshes[i].boundsMin, meshes[i].boundsMax)){
+                    meshVisible[i] = 0;
+                    numVisible--;
+                }
+            }
+        }
+        cullCounters().visible += numVisible;
+        cullCounters().culled += meshes.size() - inFrustum;
+        cullCounters().occluded += inFrustum - numVisible;
+        if(numVisible == 0)
+            return;
+
+        float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		for(unsigned int i = 0; i < meshes.size(); i++){
+            if(meshVisible[i] && !meshes[i].lods.empty())
+                selectLod(meshes[i], model, scale, view);
+        }
+		GLState::instance().bindVertexArray(this->VAO);
+		for(const DrawBatch& batch : drawBatches)
+            drawBatch(batch, true);
+	}
+private:
+    GLint hasTextureLocation = -1;
+    GLint hasSpecularMapLocation = -1;
+    GLint hasNormalMapLocation = -1;
+    GLint packedMaterialsLocation = -1;
+    //uniform buffer of the MaterialTable block, rebuilt when the MaterialArrays change
+    GLuint materialTable = 0;
+    unsigned int materialTableVersion = 0;
+    //arguments of the multi draw, reused by every batch
+    std::vector<GLsizei> drawCounts;
+    std::vector<const void*> drawOffsets;
+    std::vector<GLint> drawBaseVertices;
+    //bounds of every mesh for cullBounds, and its result of the last draw
+    CullBounds cullBoundsSoA;
+    std::vector<uint8_t> meshVisible;
+
+    //the occluder of a large mesh is its coarsest level close enough to it. the levels only use vertices of the mesh,
+    //so the occluder stays inside the bounding box of the mesh and never hides it
+    void selectOccluders(){
+        for(BasicMeshEntry& mesh : meshes){
+            mesh.occluderLevel = -1;
+            if(mesh.radius < OCCLUDER_MIN_RADIUS)
+                continue;
+            if(mesh.numIndices / 3 <= OCCLUDER_MAX_TRIANGLES)
+                mesh.occluderLevel = 0;
+            for(unsigned int level = 1; level <= mesh.lods.size(); level++){
+                const MeshLod& lod = mesh.lods[level - 1];
+                if(lod.error <= OCCLUDER_MAX_ERROR * mesh.radius && lod.numIndices / 3 <= OCCLUDER_MAX_TRIANGLES)
+                    mesh.occluderLevel = level;
+            }
+        }
+    }
+
+    void buildCullBounds(){
+        cullBoundsSoA.resize(meshes.size());
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            const BasicMeshEntry& mesh = meshes[i];
+            cullBoundsSoA.set(i, mesh.boundsMin, mesh.boundsMax, mesh.center, mesh.radius);
+        }
+        meshVisible.assign(meshes.size(), 1);
+    }
+
+    void selectLod(BasicMeshEntry& mesh, const glm::mat4& model, float scale, const LodView& view){
+        glm::vec3 center = glm::vec3(model * glm::vec4(mesh.center, 1.0f));
+        //distance to the closest point of the sphere, the full mesh is used when the camera is inside
+        float distance = glm::length(center - view.cameraPosition) - mesh.radius * scale;
+        if(distance <= 0.0f){
+            mesh.currentLod = 0;
+            return;
+        }
+        float pixelsPerUnit = scale * view.pixelScale / distance;
+        auto pixelError = [&](unsigned int level){ return level == 0 ? 0.0f : mesh.lods[level - 1].error * pixelsPerUnit; };
+
+        unsigned int level = std::min(mesh.currentLod, (unsigned int) mesh.lods.size());
+        while(level > 0 && pixelError(level) > LOD_PIXEL_ERROR)
+            level--;
+        while(level < mesh.lods.size() && pixelError(level + 1) < LOD_PIXEL_ERROR * LOD_HYSTERESIS)
+            level++;
+        mesh.currentLod = level;
+    }
+
+    //the meshes in the order of drawOrder, so every batch is a range of commands
+    void makeCullBuffers(){
+        std::vector<GpuCullMesh> cullMeshes(meshes.size());
+        std::vector<GpuCullLevel> levels;
+        std::vector<DrawElementsIndirectCommand> commands(meshes.size());
+        for(unsigned int i = 0; i < drawOrder.size(); i++){
+            const BasicMeshEntry& mesh = meshes[drawOrder[i]];
+            size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+            GpuCullMesh& cullMesh = cullMeshes[i];
+            cullMesh.centerRadius = glm::vec4(mesh.center, mesh.radius);
+            cullMesh.extent = glm::vec4(glm::max(mesh.boundsMax - mesh.center, mesh.center - mesh.boundsMin), 0.0f);
+            cullMesh.firstLevel = levels.size();
+            cullMesh.numLevels = mesh.lods.size() + 1;
+            cullMesh.command = i;
+            cullMesh.currentLevel = 0;
+            levels.push_back({mesh.numIndices, (GLuint)(mesh.indexOffset / indexSize), 0.0f, 0});
+            for(const MeshLod& lod : mesh.lods)
+                levels.push_back({lod.numIndices, (GLuint)(lod.indexOffset / indexSize), lod.error, 0});
+            commands[i] = {mesh.numIndices, 0, (GLuint)(mesh.indexOffset / indexSize), (GLint) mesh.baseVertex, 0};
+        }
+
+        glGenBuffers(NUM_CULL_BUFFERS, cullBuffers);
+        GLState& state = GLState::instance();
+        state.bindBuffer(GL_COPY_WRITE_BUFFER, cullBuffers[CULL_MESH_BUFFER]);
+        glBufferData(GL_COPY_WRITE_BUFFER, cullMeshes.size() * sizeof(GpuCullMesh), cullMeshes.data(), GL_DYNAMIC_COPY);
+        state.bindBuffer(GL_COPY_WRITE_BUFFER, cullBuffers[CULL_LEVEL_BUFFER]);
+        glBufferData(GL_COPY_WRITE_BUFFER, levels.size() * sizeof(GpuCullLevel), levels.data(), GL_STATIC_DRAW);
+        state.bindBuffer(GL_COPY_WRITE_BUFFER, cullBuffers[CULL_COMMAND_BUFFER]);
+        glBufferData(GL_COPY_WRITE_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_COPY);
+    }
+
+    //cull and select the levels on the GPU, then one indirect multi draw per batch
+    void drawIndirect(const glm::mat4& model, const LodView& view){
+        if(meshes.empty())
+            return;
+        if(!cullBuffers[0])
+            makeCullBuffers();
+        view.gpuCulling->cull(cullBuffers, meshes.size(), model, view.viewProjection, view.cameraPosition, view.pixelScale);
+        cullCounters().gpuTested += meshes.size();
+
+		GLState& state = GLState::instance();
+		state.bindVertexArray(this->VAO);
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, cullBuffers[CULL_COMMAND_BUFFER]);
+        for(const DrawBatch& batch : drawBatches){
+            bindMaterial(batch.materialIndex);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, batch.indexType, (const void*)(batch.firstMesh * sizeof(DrawElementsIndirectCommand)),
+                                        batch.numMeshes, 0);
+            drawCalls()++;
+        }
+    }
+
+    //one draw call for every mesh of the batch, only the visible ones at their selected level when useView is set
+    void drawBatch(const DrawBatch& batch, bool useView){
+        drawCounts.clear();
+        drawOffsets.clear();
+        drawBaseVertices.clear();
+        for(unsigned int i = batch.firstMesh; i < batch.firstMesh + batch.numMeshes; i++){
+            if(useView && !meshVisible[drawOrder[i]])
+                continue;
+            const BasicMeshEntry& mesh = meshes[drawOrder[i]];
+            unsigned int level = useView ? mesh.currentLod : 0;
+            unsigned int numIndices = level == 0 ? mesh.numIndices : mesh.lods[level - 1].numIndices;
+            if(numIndices == 0)
+                continue;
+            drawCounts.push_back(numIndices);
+            drawOffsets.push_back((const void*)(level == 0 ? mesh.indexOffset : mesh.lods[level - 1].indexOffset));
+            drawBaseVertices.push_back(mesh.baseVertex);
+        }
+        if(drawCounts.empty())
+            return;
+
+        bindMaterial(batch.materialIndex);
+        if(drawCounts.size() == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, drawCounts[0], batch.indexType, (void*)drawOffsets[0], drawBaseVertices[0]);
+        else
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), batch.indexType,
+                                          (void* const*) drawOffsets.data(), drawCounts.size(), drawBaseVertices.data());
+        drawCalls()++;
+    }
+
+    void bindMaterial(unsigned int materialIndex){
+        GLState& state = GLState::instance();
+        state.uniform1i(packedMaterialsLocation, packedMaterials);
+        if(packedMaterials){
+            bindMaterialTable();
+            return;
+        }
+        Material& mat = materials[materialIndex];
+
+        //a batch using the textures already bound skips the binds and the flags
+        bool hasTexture = mat.pDiffuse && mat.pDiffuse->isLoaded();
+        if(hasTexture)
+            mat.pDiffuse->bind(GL_TEXTURE0);
+        state.uniform1i(hasTextureLocation, hasTexture);
+
+        bool hasSpecularMap = mat.pSpecularExponent && mat.pSpecularExponent->isLoaded();
+        if(hasSpecularMap)
+            mat.pSpecularExponent->bind(GL_TEXTURE1);
+        state.uniform1i(hasSpecularMapLocation, hasSpecularMap);
+
+        bool hasNormalMap = mat.pNormal && mat.pNormal->isLoaded();
+        if(hasNormalMap)
+            mat.pNormal->bind(GL_TEXTURE2);
+        state.uniform1i(hasNormalMapLocation, hasNormalMap);
+    }
+
+    //the layers and rectangles of the textures of every material, for the MaterialTable block of LIGHT.frag
+    void bindMaterialTable(){
+        MaterialArrays& arrays = MaterialArrays::instance();
+        GLState& state = GLState::instance();
+        unsigned int version = arrays.getVersion();
+        if(!materialTable || version != materialTableVersion){
+            std::vector<MaterialTableEntry> entries(MATERIAL_TABLE_SIZE);
+            for(unsigned int i = 0; i < materialPaths.size() && i < MATERIAL_TABLE_SIZE; i++){
+                MaterialSlot diffuse = arrays.slot(materialPaths[i].diffuse);
+                MaterialSlot specular = arrays.slot(materialPaths[i].specular);
+                MaterialSlot normal = arrays.slot(materialPaths[i].normal);
+                entries[i] = {diffuse.transform, specular.transform, normal.transform, glm::ivec4(diffuse.layer, specular.layer, normal.layer, 0),
+                              glm::ivec4(diffuse.array, specular.array, normal.array, 0), glm::vec4(diffuse.maxLod, specular.maxLod, normal.maxLod, 0.0f)};
+            }
+            if(!materialTable)
+                glGenBuffers(1, &materialTable);
+            state.bindBuffer(GL_UNIFORM_BUFFER, materialTable);
+            glBufferData(GL_UNIFORM_BUFFER, entries.size() * sizeof(MaterialTableEntry), entries.data(), GL_STATIC_DRAW);
+            materialTableVersion = version;
+        }
+        state.bindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_TABLE_BINDING, materialTable);
+        arrays.bind();
+    }
+
+    //material of every vertex, the vertices of a mesh all belong to its material
+    void uploadMaterialIndices(){
+        std::vector<uint8_t> vertexMaterials(positions.size(), 0xFF);
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            if(meshes[i].materialIndex < MATERIAL_TABLE_SIZE)
+                memset(&vertexMaterials[meshes[i].baseVertex], meshes[i].materialIndex, meshVertexCount(i));
+        }
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, buffers[MATERIAL_VB]);
+        glBufferData(GL_ARRAY_BUFFER, vertexMaterials.size(), vertexMaterials.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(MATERIAL_LOC);
+        glVertexAttribIPointer(MATERIAL_LOC, 1, GL_UNSIGNED_BYTE, 0, 0);
+    }
+
+    void uploadFloatVertices(){
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, buffers[POS_VB]);
         glBufferData(GL_ARRAY_BUFFER, sizeof(positions[0])* positions.size(), &positions[0], GL_STATIC_DRAW);
         glEnableVertexAttribArray(POSITION_LOC);
         glVertexAttribPointer(POSITION_LOC, 3, GL_FLOAT, GL_FALSE, 0, 0);
     
         
-        glBindBuffer(GL_ARRAY_BUFFER, buffers[TEXCOORD_VB]);
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, buffers[TEXCOORD_VB]);
         glBufferData(GL_ARRAY_BUFFER, sizeof(textCoords[0])* textCoords.size(), &textCoords[0], GL_STATIC_DRAW);
         glEnableVertexAttribArray(TEXTURECOORD_LOC);
         glVertexAttribPointer(TEXTURECOORD_LOC, 2, GL_FLOAT, GL_FALSE, 0, 0);
        
 
-        glBindBuffer(GL_ARRAY_BUFFER, buffers[NORMAL_VB]);
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, buffers[NORMAL_VB]);
         glBufferData(GL_ARRAY_BUFFER, sizeof(normals[0])* normals.size(), &normals[0], GL_STATIC_DRAW);
         glEnableVertexAttribArray(NORMAL_LOC);
         glVertexAttribPointer(NORMAL_LOC, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-        glBindBuffer(GL_ARRAY_BUFFER, buffers[TANGENT_VB]);
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, buffers[TANGENT_VB]);
         glBufferData(GL_ARRAY_BUFFER, sizeof(tangents[0])* tangents.size(), &tangents[0], GL_STATIC_DRAW);
         glEnableVertexAttribArray(TANGENT_LOC);
         glVertexAttribPointer(TANGENT_LOC, 3, GL_FLOAT, GL_FALSE, 0, 0);
@@ -175,62 +787,83 @@ public:
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[INDEX_BUFFER]);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0])* indices.size(), &indices[0], GL_STATIC_DRAW);
 
-        //unbind VAO
-        glBindVertexArray(0);
-
-		//unbind the buffers
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        this->hasTextureLocation = glGetUniformLocation(shader.ID, "hasTexture");
-        this->hasSpecularMapLocation = glGetUniformLocation(shader.ID, "hasSpecularMap");
-        this->hasNormalMapLocation = glGetUniformLocation(shader.ID, "hasNormalMap");
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            meshes[i].indexType = GL_UNSIGNED_INT;
+            meshes[i].indexOffset = sizeof(unsigned int) * meshes[i].baseIndex;
+            for(MeshLod& lod : meshes[i].lods)
+                lod.indexOffset = sizeof(unsigned int) * lod.baseIndex;
+        }
     }
 
+    //interleaved and quantized vertices, see VERTEX_FORMAT_PACKED
+    void uploadPackedVertices(){
+        bool withTangents = false;
+        for(unsigned int i = 0; i < materialPaths.size(); i++)
+            withTangents = withTangents || !materialPaths[i].normal.empty();
 
-	void draw() {
-		glBindVertexArray(this->VAO);
-		for(unsigned int i=0; i< meshes.size(); i++){
-            Material& mat = materials[meshes[i].materialIndex];
-                
-            if(mat.pDiffuse){
-                mat.pDiffuse->bind(GL_TEXTURE0);
-                if(hasTextureLocation != -1)
-                    glUniform1i(hasTextureLocation, 1);
-            }else if(hasTextureLocation != -1)
-                glUniform1i(hasTextureLocation, 0);
-            
-            
-            
-            if(mat.pSpecularExponent){
-                mat.pSpecularExponent->bind(GL_TEXTURE1);
-                if(hasSpecularMapLocation != -1)
-                    glUniform1i(hasSpecularMapLocation, 1);
-            }else if(hasSpecularMapLocation != -1)
-                glUniform1i(hasSpecularMapLocation, 0);
-            
-            
-            if(mat.pNormal){ 
-                mat.pNormal->bind(GL_TEXTURE2);
-                if(hasNormalMapLocation != -1)
-                    glUniform1i(hasNormalMapLocation, 1);
-            }else if(hasNormalMapLocation != -1)
-                glUniform1i(hasNormalMapLocation, 0);
-            
-           
-             glDrawElementsBaseVertex(GL_TRIANGLES,
-                                 meshes[i].numIndices,
-                                 GL_UNSIGNED_INT,
-                                 (void*)(sizeof(unsigned int) * meshes[i].baseIndex),
-                                 meshes[i].baseVertex);
-        }
-
-        // unbind VAO
-        glBindVertexArray(0);
-	}
-private:
-    GLuint hasTextureLocation;
-    GLuint hasSpecularMapLocation;
-    GLuint hasNormalMapLocation;
+        size_t stride = withTangents ? sizeof(PackedVertex) : offsetof(PackedVertex, tangent);
+        std::vector<unsigned char> vertexData(stride * positions.size());
+        for(unsigned int i = 0; i < positions.size(); i++){
+            PackedVertex v;
+            v.position = positions[i];
+            v.normal = glm::packSnorm3x10_1x2(glm::vec4(normals[i], 0.0f));
+            v.textCoord = glm::packHalf2x16(textCoords[i]);
+            v.tangent = glm::packSnorm3x10_1x2(glm::vec4(tangents[i], 0.0f));
+            memcpy(&vertexData[i * stride], &v, stride);
+        }
+
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, buffers[POS_VB]);
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(POSITION_LOC);
+        glVertexAttribPointer(POSITION_LOC, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, position));
+        glEnableVertexAttribArray(NORMAL_LOC);
+        glVertexAttribPointer(NORMAL_LOC, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal));
+        glEnableVertexAttribArray(TEXTURECOORD_LOC);
+        glVertexAttribPointer(TEXTURECOORD_LOC, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, textCoord));
+        if(withTangents){
+            glEnableVertexAttribArray(TANGENT_LOC);
+            glVertexAttribPointer(TANGENT_LOC, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(PackedVertex, tangent));
+        }
+
+        //indices are relative to baseVertex, a mesh fits in 16 bits when its largest index does
+        std::vector<unsigned char> indexData;
+        indexData.reserve(sizeof(unsigned int) * indices.size());
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            BasicMeshEntry& mesh = meshes[i];
+            unsigned int maxIndex = 0;
+            for(unsigned int j = 0; j < mesh.numIndices; j++)
+                maxIndex = std::max(maxIndex, indices[mesh.baseIndex + j]);
+
+            //the LOD levels use a subset of the vertices, their indices fit in the same type
+            mesh.indexType = maxIndex <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            mesh.indexOffset = appendIndices(indexData, mesh.baseIndex, mesh.numIndices, mesh.indexType);
+            for(MeshLod& lod : mesh.lods)
+                lod.indexOffset = appendIndices(indexData, lod.baseIndex, lod.numIndices, mesh.indexType);
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[INDEX_BUFFER]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.data(), GL_STATIC_DRAW);
+
+        size_t floatVertexSize = sizeof(positions[0]) + sizeof(textCoords[0]) + sizeof(normals[0]) + sizeof(tangents[0]);
+        std::cout << "Packed vertices of " << path << ": " << floatVertexSize << " -> " << stride << " bytes per vertex, "
+                  << "indices " << sizeof(unsigned int) * indices.size() << " -> " << indexData.size() << " bytes" << std::endl;
+    }
+
+    //returns the offset of the indices in indexData
+    size_t appendIndices(std::vector<unsigned char>& indexData, unsigned int baseIndex, unsigned int numIndices, GLenum indexType){
+        size_t offset = (indexData.size() + 3) & ~(size_t)3;
+        indexData.resize(offset);
+        for(unsigned int j = 0; j < numIndices; j++){
+            unsigned int index = indices[baseIndex + j];
+            if(indexType == GL_UNSIGNED_SHORT){
+                uint16_t index16 = (uint16_t) index;
+                indexData.insert(indexData.end(), (unsigned char*)&index16, (unsigned char*)&index16 + sizeof(index16));
+            }else{
+                indexData.insert(indexData.end(), (unsigned char*)&index, (unsigned char*)&index + sizeof(index));
+            }
+        }
+        return offset;
+    }
 
     void countVerticesAndIndices(const aiScene* pScene, unsigned int& numVertices, unsigned int& numIndices){
         for (unsigned int i = 0 ; i < meshes.size() ; i++) {
@@ -244,77 +877,226 @@ private:
         }
     }
 
-    void initMaterials(const aiScene* pScene, const char* path){
-      
-        //loop over every material
-        for(unsigned int i = 0; i < pScene->mNumMaterials; i ++){
-            const aiMaterial* pMaterial = pScene->mMaterials[i];
-            //load diffuse texture
-            if(pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0){
-
-                aiString path;
-                if(pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS){   
-                   
-                    std::string p(path.data);
-                    std::string::size_type slashIndex = p.find_last_of("/") + 1;
-                    std::string fullPath = PATH_TO_OBJECTS  "/textures/" + p.substr(slashIndex);
-
-                    materials[i].pDiffuse = new Texture(fullPath.c_str());
-                    if (!materials[i].pDiffuse->load(GL_TEXTURE0)) {
-                        std::cout << "Error loading diffuse texture "  << fullPath.c_str() << std::endl;
-                    } else {
-                        std::cout << "Loaded diffuse texture " << fullPath.c_str() << " at index " << i << std::endl;
-                    }
-        
-                }
-            }else{
-                std::cout << "No diffuse texture"   << std::endl;
+    bool importFile(const char* path){
+        Assimp::Importer importer;
+
+        const aiScene* pScene = importer.ReadFile(path, ASSIMP_LOAD_FLAGS);
+
+        if(!pScene){
+            std::cerr << "Error importing file " << path << ": " << importer.GetErrorString() << std::endl;
+            return false;
+        }
+
+        meshes.resize(pScene->mNumMeshes);
+        materials.resize(pScene->mNumMaterials);
+
+        //find total number of vertices/indices over all meshes to reserve space
+        unsigned int numVertices = 0;
+        unsigned int numIndices = 0;
+
+        countVerticesAndIndices(pScene, numVertices, numIndices);
+
+        positions.reserve(numVertices);
+        textCoords.reserve(numVertices);
+        normals.reserve(numVertices);
+        tangents.reserve(numVertices);
+        indices.reserve(numIndices);
+
+        //populate buffers for every meshes
+        for(unsigned int meshIdx =0; meshIdx < meshes.size(); meshIdx++){
+            const aiMesh* paiMesh = pScene->mMeshes[meshIdx];
+            const aiVector3D zero3D(0.0f, 0.0f, 0.0f);
+
+            //populate vertex attribute buffers for this mesh
+            for(unsigned int i = 0; i < paiMesh->mNumVertices; i++){
+                const aiVector3D& pPos = paiMesh->mVertices[i];
+                positions.push_back(glm::vec3(pPos.x,pPos.y,pPos.z));
+
+                const aiVector3D& pNormal = paiMesh->mNormals[i];
+                normals.push_back(glm::vec3(pNormal.x,pNormal.y,pNormal.z));
+
+                //keep one tangent per vertex so every attribute array stays aligned
+                const aiVector3D& pTangent = paiMesh->HasTangentsAndBitangents() ? paiMesh->mTangents[i] : zero3D;
+                tangents.push_back(glm::vec3(pTangent.x,pTangent.y,pTangent.z));
+
+                const aiVector3D& pTexture = paiMesh->HasTextureCoords(0) ? paiMesh->mTextureCoords[0][i] : zero3D;
+                textCoords.push_back(glm::vec2(pTexture.x,pTexture.y));
             }
-           
-            //load normal texture
-            if(pMaterial->GetTextureCount(aiTextureType_NORMALS) > 0){
-
-                aiString path;
-                if(pMaterial->GetTexture(aiTextureType_NORMALS, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS){   
-                   
-                    std::string p(path.data);
-                    std::string::size_type slashIndex = p.find_last_of("/") + 1;
-                    std::string fullPath = PATH_TO_OBJECTS  "/textures/" + p.substr(slashIndex);
-
-                    materials[i].pNormal = new Texture(fullPath.c_str());
-                    if (!materials[i].pNormal->load(GL_TEXTURE1)) {
-                        std::cout << "Error loading normal texture "  << fullPath.c_str() << std::endl;
-                    } else {
-                        std::cout << "Loaded normal texture " << fullPath.c_str() << " at index " << i << std::endl;
-                    }
-        
-                }
-            }else{
-                std::cout << "No normal texture" << std::endl;
+
+            //populate index buffers for this mesh
+            for(unsigned int i = 0; i < paiMesh->mNumFaces; i++){
+                const aiFace& face = paiMesh->mFaces[i];
+                assert(face.mNumIndices == 3);
+                indices.push_back(face.mIndices[0]);
+                indices.push_back(face.mIndices[1]);
+                indices.push_back(face.mIndices[2]);
             }
+        }
 
-            //load specular map
-            if(pMaterial->GetTextureCount(aiTextureType_SPECULAR) > 0){
-
-                aiString path;
-                if(pMaterial->GetTexture(aiTextureType_SPECULAR, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS){   
-                   
-                    std::string p(path.data);
-                    std::string::size_type slashIndex = p.find_last_of("/") + 1;
-                    std::string fullPath = PATH_TO_OBJECTS  "/textures/" + p.substr(slashIndex);
-
-                    materials[i].pSpecularExponent = new Texture(fullPath.c_str());
-                    if (!materials[i].pSpecularExponent->load(GL_TEXTURE2)) {
-                        std::cout << "Error loading specular texture "  << fullPath.c_str() << std::endl;
-                    } else {
-                        std::cout << "Loaded specular texture " << fullPath.c_str() << " at index " << i << std::endl;
-                    }
-        
-                }
-            }else{
-                std::cout << "No specular texture"   << std::endl;
+        //now, find the textures of every material of this scene
+        initMaterialPaths(pScene);
+        return true;
+    }
+
+public:
+    //also used by the world streaming, a tile is cached under the hash of the whole source file
+    bool loadFromCache(const char* path, uint64_t sourceHash, uint32_t options){
+        if(sourceHash == 0)
+            return false;
+
+        MeshCacheReader reader;
+        if(!reader.open(meshCachePath(path, options), sourceHash, ASSIMP_LOAD_FLAGS, options))
+            return false;
+
+        const MeshCacheHeader& h = reader.header;
+        const glm::vec3* pPositions = reader.read<glm::vec3>(h.numVertices);
+        const glm::vec3* pNormals = reader.read<glm::vec3>(h.numVertices);
+        const glm::vec3* pTangents = reader.read<glm::vec3>(h.numVertices);
+        const glm::vec2* pTextCoords = reader.read<glm::vec2>(h.numVertices);
+        const unsigned int* pIndices = reader.read<unsigned int>(h.numIndices);
+        const MeshCacheEntry* pMeshes = reader.read<MeshCacheEntry>(h.numMeshes);
+        const MeshCacheLod* pLods = reader.read<MeshCacheLod>(h.numLods);
+        if(!pPositions || !pNormals || !pTangents || !pTextCoords || !pIndices || !pMeshes || !pLods)
+            return false;
+        for(unsigned int i = 0; i < h.numLods; i++){
+            if(pLods[i].meshIndex >= h.numMeshes)
+                return false;
+        }
+
+        std::vector<MaterialPaths> paths(h.numMaterials);
+        for(unsigned int i = 0; i < h.numMaterials; i++){
+            if(!reader.readString(paths[i].diffuse) || !reader.readString(paths[i].normal) || !reader.readString(paths[i].specular))
+                return false;
+        }
+
+        positions.assign(pPositions, pPositions + h.numVertices);
+        normals.assign(pNormals, pNormals + h.numVertices);
+        tangents.assign(pTangents, pTangents + h.numVertices);
+        textCoords.assign(pTextCoords, pTextCoords + h.numVertices);
+        indices.assign(pIndices, pIndices + h.numIndices);
+
+        meshes.resize(h.numMeshes);
+        for(unsigned int i = 0; i < h.numMeshes; i++){
+            meshes[i].numIndices = pMeshes[i].numIndices;
+            meshes[i].baseVertex = pMeshes[i].baseVertex;
+            meshes[i].baseIndex = pMeshes[i].baseIndex;
+            meshes[i].materialIndex = pMeshes[i].materialIndex;
+            meshes[i].boundsMin = glm::make_vec3(pMeshes[i].boundsMin);
+            meshes[i].boundsMax = glm::make_vec3(pMeshes[i].boundsMax);
+            meshes[i].center = glm::make_vec3(pMeshes[i].center);
+            meshes[i].radius = pMeshes[i].radius;
+            meshes[i].lods.clear();
+        }
+        for(unsigned int i = 0; i < h.numLods; i++){
+            MeshLod lod = {pLods[i].numIndices, pLods[i].baseIndex, pLods[i].error, 0};
+            meshes[pLods[i].meshIndex].lods.push_back(lod);
+        }
+
+        materialPaths.swap(paths);
+        materials.resize(h.numMaterials);
+        std::cout << "Loaded object from cache " << meshCachePath(path, options) << std::endl;
+        return true;
+    }
+
+    void saveToCache(const char* path, uint64_t sourceHash, uint32_t options){
+        if(sourceHash == 0)
+            return;
+
+        MeshCacheHeader header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.loadFlags = ASSIMP_LOAD_FLAGS;
+        header.numVertices = positions.size();
+        header.numIndices = indices.size();
+        header.numMeshes = meshes.size();
+        header.numMaterials = materialPaths.size();
+        header.options = options;
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            header.numLods += meshes[i].lods.size();
+
+        MeshCacheWriter writer;
+        if(!writer.open(meshCachePath(path, options), header)){
+            std::cout << "Can not write mesh cache " << meshCachePath(path, options) << std::endl;
+            return;
+        }
+        writer.write(positions.data(), positions.size());
+        writer.write(normals.data(), normals.size());
+        writer.write(tangents.data(), tangents.size());
+        writer.write(textCoords.data(), textCoords.size());
+        writer.write(indices.data(), indices.size());
+
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            const BasicMeshEntry& mesh = meshes[i];
+            MeshCacheEntry entry = {};
+            entry.numIndices = mesh.numIndices;
+            entry.baseVertex = mesh.baseVertex;
+            entry.baseIndex = mesh.baseIndex;
+            entry.materialIndex = mesh.materialIndex;
+            for(int axis = 0; axis < 3; axis++){
+                entry.boundsMin[axis] = mesh.boundsMin[axis];
+                entry.boundsMax[axis] = mesh.boundsMax[axis];
+                entry.center[axis] = mesh.center[axis];
+            }
+            entry.radius = mesh.radius;
+            writer.write(&entry, 1);
+        }
+        for(unsigned int i = 0; i < meshes.size(); i++){
+            for(MeshLod& lod : meshes[i].lods){
+                MeshCacheLod entry = {i, lod.numIndices, lod.baseIndex, lod.error};
+                writer.write(&entry, 1);
+            }
+        }
+        for(unsigned int i = 0; i < materialPaths.size(); i++){
+            writer.writeString(materialPaths[i].diffuse);
+            writer.writeString(materialPaths[i].normal);
+            writer.writeString(materialPaths[i].specular);
+        }
+
+        if(!writer.close())
+            std::cout << "Can not write mesh cache " << meshCachePath(path, options) << std::endl;
+    }
+
+private:
+    //returns the full path of the first texture of this type, or an empty string
+    std::string getTexturePath(const aiMaterial* pMaterial, aiTextureType type){
+        if(pMaterial->GetTextureCount(type) > 0){
+            aiString path;
+            if(pMaterial->GetTexture(type, 0, &path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS){
+                std::string p(path.data);
+                std::string::size_type slashIndex = p.find_last_of("/") + 1;
+                return PATH_TO_OBJECTS  "/textures/" + p.substr(slashIndex);
             }
         }
+        return "";
+    }
+
+    void initMaterialPaths(const aiScene* pScene){
+        materialPaths.resize(pScene->mNumMaterials);
+        for(unsigned int i = 0; i < pScene->mNumMaterials; i ++){
+            const aiMaterial* pMaterial = pScene->mMaterials[i];
+            materialPaths[i].diffuse = getTexturePath(pMaterial, aiTextureType_DIFFUSE);
+            materialPaths[i].normal = getTexturePath(pMaterial, aiTextureType_NORMALS);
+            materialPaths[i].specular = getTexturePath(pMaterial, aiTextureType_SPECULAR);
+        }
+    }
+
+    std::shared_ptr<Texture> createTexture(const std::string& fullPath, const char* type){
+        if(fullPath.empty()){
+            std::cout << "No " << type << " texture" << std::endl;
+            return NULL;
+        }
+        return TextureCache::instance().acquire(fullPath);
+    }
+
+    void loadTexture(const std::shared_ptr<Texture>& texture, GLenum textureUnit, const char* type, unsigned int materialIdx){
+        if(!texture || texture->isLoaded())
+            return;
+        if (!texture->load(textureUnit)) {
+            std::cout << "Error loading " << type << " texture "  << texture->getFileName() << std::endl;
+        } else {
+            std::cout << "Loaded " << type << " texture " << texture->getFileName() << " at index " << materialIdx << std::endl;
+        }
     }
 };
 
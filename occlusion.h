@@ -0,0 +1,326 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE
+#include <emmintrin.h>
+#endif
+
+/* Software occlusion culling, CPU only.
+Every frame the occluders closest to the camera (simplified copies of the large meshes, see
+Object::selectOccluders) are rasterized into a small depth buffer, then the bounding boxes of the
+meshes are tested against it before their draw: a box whose every pixel is behind an occluder is hidden.
+The buffer stores 1 / w (0 is empty, larger is closer) which is linear on the screen, so it is interpolated
+exactly over a triangle. 4 pixels of a row are handled at once with SSE2, the rows are split in bands
+rasterized by several threads: the calling thread and workers owned by the buffer, started by the first
+rasterize that needs them and kept waiting for the next frame.
+Pixels are only covered when their center is inside a triangle and boxes cover every pixel they touch,
+so a box is never hidden by its own occluder: the occluder of a mesh is made of vertices of the mesh.
+*/
+#define OCCLUSION_WIDTH 256 //pixels, a multiple of 4
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_MAX_TRIANGLES 16384 //occluder triangles rasterized per frame, the ones with the largest priority
+#define OCCLUSION_NEAR_W 0.01f //triangles are clipped at this w, boxes crossing it are always visible
+#define OCCLUSION_MIN_ROWS_PER_THREAD 16
+
+class OcclusionBuffer {
+public:
+    OcclusionBuffer(int width = OCCLUSION_WIDTH, int height = OCCLUSION_HEIGHT)
+        : width((width + 3) & ~3), height(height), depth(this->width * height, 0.0f) {
+    }
+
+    //the workers read the triangles and write the depth of the buffer
+    OcclusionBuffer(const OcclusionBuffer&) = delete;
+    OcclusionBuffer& operator=(const OcclusionBuffer&) = delete;
+
+    ~OcclusionBuffer(){
+        {
+            std::lock_guard<std::mutex> lock(workMutex);
+            stopping = true;
+        }
+        workStart.notify_all();
+        for(std::thread& worker : workers)
+            worker.join();
+    }
+
+    //start a frame, the occluders are added after this
+    void begin(const glm::mat4& viewProjection){
+        this->viewProjection = viewProjection;
+        occluders.clear();
+        triangles.clear();
+        std::fill(depth.begin(), depth.end(), 0.0f);
+    }
+
+    //triangles (indices[i] + baseVertex) moved by model, kept until the next begin.
+    //priority orders the occluders when there are more than OCCLUSION_MAX_TRIANGLES triangles, larger first
+    void addOccluder(const glm::vec3* positions, const unsigned int* indices, unsigned int numIndices, unsigned int baseVertex,
+                     const glm::mat4& model, float priority){
+        occluders.push_back({positions, indices, numIndices, baseVertex, viewProjection * model, priority});
+    }
+
+    //rasterize the occluders, on up to maxThreads threads (the calling thread included)
+    void rasterize(unsigned int maxThreads = 1){
+        std::sort(occluders.begin(), occluders.end(), [](const Occluder& a, const Occluder& b){ return a.priority > b.priority; });
+        size_t budget = OCCLUSION_MAX_TRIANGLES;
+        for(const Occluder& occluder : occluders){
+            if(occluder.numIndices / 3 > budget)
+                continue;
+            budget -= occluder.numIndices / 3;
+            setupTriangles(occluder);
+        }
+        rasterizedTriangles = triangles.size();
+
+        unsigned int threads = std::max(1u, std::min<unsigned int>(maxThreads, height / OCCLUSION_MIN_ROWS_PER_THREAD));
+        if(threads < 2 || triangles.size() < 64){
+            rasterizeRows(0, height);
+            return;
+        }
+        //band 0 is rasterized by the calling thread, band b by workers[b - 1]
+        while(workers.size() < threads - 1){
+            unsigned int band = workers.size() + 1;
+            workers.emplace_back(&OcclusionBuffer::workerLoop, this, band);
+        }
+        int rows = (height + threads - 1) / threads;
+        {
+            std::lock_guard<std::mutex> lock(workMutex);
+            bandRows = rows;
+            activeBands = threads;
+            pendingBands = threads - 1;
+            frame++;
+        }
+        workStart.notify_all();
+        rasterizeRows(0, std::min(height, rows));
+        std::unique_lock<std::mutex> lock(workMutex);
+        workDone.wait(lock, [this]{ return pendingBands == 0; });
+    }
+
+    //false when the box, in the space of modelViewProjection, is behind the occluders at every pixel it covers
+    bool isVisible(const glm::mat4& modelViewProjection, const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, nearest = 0.0f;
+        for(int corner = 0; corner < 8; corner++){
+            glm::vec3 p = glm::vec3(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z);
+            glm::vec4 clip = modelViewProjection * glm::vec4(p, 1.0f);
+            if(clip.w <= OCCLUSION_NEAR_W)
+                return true;
+            float inverseW = 1.0f / clip.w;
+            float x = (clip.x * inverseW * 0.5f + 0.5f) * width, y = (clip.y * inverseW * 0.5f + 0.5f) * height;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::max(nearest, inverseW);
+        }
+        int x0 = std::max(0, (int) std::floor(minX)), x1 = std::min(width, (int) std::ceil(maxX));
+        int y0 = std::max(0, (int) std::floor(minY)), y1 = std::min(height, (int) std::ceil(maxY));
+        if(x0 >= x1 || y0 >= y1)
+            return true;//the frustum test said it is on the screen
+
+        for(int y = y0; y < y1; y++){
+            const float* row = &depth[y * width];
+            int x = x0;
+#ifdef OCCLUSION_SSE
+            __m128 boxDepth = _mm_set1_ps(nearest);
+            for(; x + 4 <= x1; x += 4){
+                if(_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), boxDepth)))
+                    return true;
+            }
+#endif
+            for(; x < x1; x++){
+                if(row[x] <= nearest)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    //triangles rasterized by the last rasterize
+    size_t triangleCount() const {
+        return rasterizedTriangles;
+    }
+
+    //1 / w of every pixel, row 0 is the bottom of the screen
+    const std::vector<float>& depthBuffer() const {
+        return depth;
+    }
+
+    const int width;
+    const int height;
+
+private:
+    struct Occluder {
+        const glm::vec3* positions;
+        const unsigned int* indices;
+        unsigned int numIndices;
+        unsigned int baseVertex;
+        glm::mat4 modelViewProjection;
+        float priority;
+    };
+
+    //a triangle on the screen: edge functions a * x + b * y + c >= 0 inside, depth = z0 + zx * x + zy * y.
+    //a pixel center on an edge is covered by both triangles sharing it, so a mesh has no crack between its triangles
+    struct ScreenTriangle {
+        float a[3], b[3], c[3];
+        float z0, zx, zy;
+        int minX, maxX, minY, maxY;//pixels covered, maxX and maxY excluded
+    };
+
+    std::vector<float> depth;
+    glm::mat4 viewProjection;
+    std::vector<Occluder> occluders;
+    std::vector<ScreenTriangle> triangles;
+    size_t rasterizedTriangles = 0;
+
+    std::vector<std::thread> workers;
+    std::mutex workMutex;
+    std::condition_variable workStart;//a frame is handed to the workers, or stopping
+    std::condition_variable workDone;
+    unsigned long frame = 0;//frames handed to the workers
+    unsigned int activeBands = 0;//bands of the frame, the workers of the other bands skip it
+    unsigned int pendingBands = 0;//bands of the frame not rasterized yet by the workers
+    int bandRows = 0;
+    bool stopping = false;
+
+    void workerLoop(unsigned int band){
+        unsigned long seenFrame = 0;
+        while(true){
+            int rowBegin, rowEnd;
+            {
+                std::unique_lock<std::mutex> lock(workMutex);
+                workStart.wait(lock, [this, seenFrame]{ return stopping || frame != seenFrame; });
+                if(stopping)
+                    return;
+                seenFrame = frame;
+                if(band >= activeBands)
+                    continue;
+                rowBegin = std::min(height, (int) band * bandRows);
+                rowEnd = std::min(height, (int) (band + 1) * bandRows);
+            }
+            rasterizeRows(rowBegin, rowEnd);
+            {
+                std::lock_guard<std::mutex> lock(workMutex);
+                pendingBands--;
+            }
+            workDone.notify_one();
+        }
+    }
+
+    void setupTriangles(const Occluder& occluder){
+        for(unsigned int i = 0; i + 2 < occluder.numIndices; i += 3){
+            glm::vec4 clip[3];
+            for(int v = 0; v < 3; v++)
+                clip[v] = occluder.modelViewProjection * glm::vec4(occluder.positions[occluder.baseVertex + occluder.indices[i + v]], 1.0f);
+
+            //clip against the near w, the polygon has up to 4 vertices
+            glm::vec4 polygon[4];
+            int count = 0;
+            for(int v = 0; v < 3; v++){
+                const glm::vec4& current = clip[v];
+                const glm::vec4& next = clip[(v + 1) % 3];
+                bool currentIn = current.w >= OCCLUSION_NEAR_W, nextIn = next.w >= OCCLUSION_NEAR_W;
+                if(currentIn)
+                    polygon[count++] = current;
+                if(currentIn != nextIn)
+                    polygon[count++] = current + (next - current) * ((OCCLUSION_NEAR_W - current.w) / (next.w - current.w));
+            }
+            for(int v = 1; v + 1 < count; v++)
+                addScreenTriangle(polygon[0], polygon[v], polygon[v + 1]);
+        }
+    }
+
+    void addScreenTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2){
+        glm::vec3 p[3];
+        const glm::vec4* clip[3] = {&c0, &c1, &c2};
+        for(int v = 0; v < 3; v++){
+            float inverseW = 1.0f / clip[v]->w;
+            p[v] = glm::vec3((clip[v]->x * inverseW * 0.5f + 0.5f) * width, (clip[v]->y * inverseW * 0.5f + 0.5f) * height, inverseW);
+        }
+        float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+        if(!(std::fabs(area) > 1e-8f))
+            return;
+        //both faces are drawn, the vertices are swapped to always get a positive area
+        if(area < 0.0f){
+            std::swap(p[1], p[2]);
+            area = -area;
+        }
+
+        ScreenTriangle t;
+        float minX = std::min(p[0].x, std::min(p[1].x, p[2].x)), maxX = std::max(p[0].x, std::max(p[1].x, p[2].x));
+        float minY = std::min(p[0].y, std::min(p[1].y, p[2].y)), maxY = std::max(p[0].y, std::max(p[1].y, p[2].y));
+        //pixel centers are at +0.5
+        t.minX = std::max(0, (int) std::floor(minX - 0.5f) + 1);
+        t.maxX = std::min(width, (int) std::floor(maxX - 0.5f) + 1);
+        t.minY = std::max(0, (int) std::floor(minY - 0.5f) + 1);
+        t.maxY = std::min(height, (int) std::floor(maxY - 0.5f) + 1);
+        if(t.minX >= t.maxX || t.minY >= t.maxY)
+            return;
+
+        for(int e = 0; e < 3; e++){
+            const glm::vec3& from = p[(e + 1) % 3];
+            const glm::vec3& to = p[(e + 2) % 3];
+            //edge e is opposite to vertex e, positive on its side
+            t.a[e] = from.y - to.y;
+            t.b[e] = to.x - from.x;
+            t.c[e] = from.x * to.y - from.y * to.x;
+        }
+        //barycentric interpolation of 1 / w written as a plane
+        float inverseArea = 1.0f / area;
+        t.zx = (t.a[0] * p[0].z + t.a[1] * p[1].z + t.a[2] * p[2].z) * inverseArea;
+        t.zy = (t.b[0] * p[0].z + t.b[1] * p[1].z + t.b[2] * p[2].z) * inverseArea;
+        t.z0 = (t.c[0] * p[0].z + t.c[1] * p[1].z + t.c[2] * p[2].z) * inverseArea;
+        triangles.push_back(t);
+    }
+
+    //rows [rowBegin, rowEnd) of every triangle, each thread writes its own rows
+    void rasterizeRows(int rowBegin, int rowEnd){
+        for(const ScreenTriangle& t : triangles){
+            int y0 = std::max(t.minY, rowBegin), y1 = std::min(t.maxY, rowEnd);
+            if(y0 >= y1)
+                continue;
+            int x0 = t.minX & ~3;//aligned for the SSE loads, the edge functions reject the extra pixels
+            for(int y = y0; y < y1; y++){
+                float* row = &depth[y * width];
+                float py = y + 0.5f;
+#ifdef OCCLUSION_SSE
+                __m128 px = _mm_add_ps(_mm_set1_ps(x0 + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[0]), px), _mm_set1_ps(t.b[0] * py + t.c[0]));
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[1]), px), _mm_set1_ps(t.b[1] * py + t.c[1]));
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.a[2]), px), _mm_set1_ps(t.b[2] * py + t.c[2]));
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.zx), px), _mm_set1_ps(t.zy * py + t.z0));
+                __m128 e0Step = _mm_set1_ps(t.a[0] * 4.0f), e1Step = _mm_set1_ps(t.a[1] * 4.0f), e2Step = _mm_set1_ps(t.a[2] * 4.0f);
+                __m128 zStep = _mm_set1_ps(t.zx * 4.0f);
+                __m128 zero = _mm_setzero_ps();
+                for(int x = x0; x < t.maxX; x += 4){
+                    __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+                    if(_mm_movemask_ps(inside)){
+                        __m128 old = _mm_loadu_ps(row + x);
+                        __m128 closer = _mm_max_ps(old, z);
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+                    }
+                    e0 = _mm_add_ps(e0, e0Step);
+                    e1 = _mm_add_ps(e1, e1Step);
+                    e2 = _mm_add_ps(e2, e2Step);
+                    z = _mm_add_ps(z, zStep);
+                }
+#else
+                for(int x = x0; x < t.maxX; x++){
+                    float pxs = x + 0.5f;
+                    if(t.a[0] * pxs + t.b[0] * py + t.c[0] >= 0.0f && t.a[1] * pxs + t.b[1] * py + t.c[1] >= 0.0f
+                       && t.a[2] * pxs + t.b[2] * py + t.c[2] >= 0.0f)
+                        row[x] = std::max(row[x], t.zx * pxs + t.zy * py + t.z0);
+                }
+#endif
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef PARTICLEKERNEL_H
+#define PARTICLEKERNEL_H
+
+#include <cstddef>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PARTICLE_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//the AVX2 function is compiled for AVX2 even when the rest of the game is not, it is only called when the CPU has it
+#if defined(PARTICLE_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PARTICLE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PARTICLE_TARGET_AVX2
+#endif
+
+/* Particle integration over struct of arrays: position += deltaTime * speed * direction, life -= deltaTime.
+The SSE (4 particles) and AVX2 (8 particles) versions are chosen at runtime by bestParticleKernel,
+every version gives the same result as the scalar loop.
+*/
+#define PARTICLE_PARALLEL_MIN 262144 //particles, under this count the threads cost more than they save
+#define PARTICLE_PARALLEL_CHUNK 65536 //minimum particles per thread
+
+enum ParticleKernel {
+    PARTICLE_KERNEL_SCALAR,
+    PARTICLE_KERNEL_SSE,
+    PARTICLE_KERNEL_AVX2,
+    NUM_PARTICLE_KERNELS
+};
+
+//fields of the particles, one array per component
+struct ParticleArrays {
+    float* positionX;
+    float* positionY;
+    float* positionZ;
+    const float* directionX;
+    const float* directionY;
+    const float* directionZ;
+    float* life;
+};
+
+const char* particleKernelName(ParticleKernel kernel){
+    switch(kernel){
+    case PARTICLE_KERNEL_SSE: return "SSE";
+    case PARTICLE_KERNEL_AVX2: return "AVX2";
+    default: return "scalar";
+    }
+}
+
+bool isParticleKernelSupported(ParticleKernel kernel){
+    if(kernel == PARTICLE_KERNEL_SCALAR)
+        return true;
+#ifdef PARTICLE_KERNEL_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    //the OS must save the AVX registers
+    bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    bool avx2 = avx && (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if(kernel == PARTICLE_KERNEL_SSE)
+        return sse2;
+    if(kernel == PARTICLE_KERNEL_AVX2)
+        return avx2;
+#endif
+    return false;
+}
+
+//widest kernel supported by the CPU, detected once
+ParticleKernel bestParticleKernel(){
+    static ParticleKernel best = isParticleKernelSupported(PARTICLE_KERNEL_AVX2) ? PARTICLE_KERNEL_AVX2
+                               : isParticleKernelSupported(PARTICLE_KERNEL_SSE) ? PARTICLE_KERNEL_SSE
+                               : PARTICLE_KERNEL_SCALAR;
+    return best;
+}
+
+void integrateParticlesScalar(const ParticleArrays& a, size_t begin, size_t end, float deltaTime, float speed){
+    float distance = deltaTime * speed;
+    for(size_t i = begin; i < end; i++){
+        a.positionX[i] += distance * a.directionX[i];
+        a.positionY[i] += distance * a.directionY[i];
+        a.positionZ[i] += distance * a.directionZ[i];
+        a.life[i] -= deltaTime;
+    }
+}
+
+#ifdef PARTICLE_KERNEL_X86
+void integrateParticlesSSE(const ParticleArrays& a, size_t begin, size_t end, float deltaTime, float speed){
+    float distance = deltaTime * speed;
+    __m128 d = _mm_set1_ps(distance);
+    __m128 dt = _mm_set1_ps(deltaTime);
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4){
+        _mm_storeu_ps(a.positionX + i, _mm_add_ps(_mm_loadu_ps(a.positionX + i), _mm_mul_ps(d, _mm_loadu_ps(a.directionX + i))));
+        _mm_storeu_ps(a.positionY + i, _mm_add_ps(_mm_loadu_ps(a.positionY + i), _mm_mul_ps(d, _mm_loadu_ps(a.directionY + i))));
+        _mm_storeu_ps(a.positionZ + i, _mm_add_ps(_mm_loadu_ps(a.positionZ + i), _mm_mul_ps(d, _mm_loadu_ps(a.directionZ + i))));
+        _mm_storeu_ps(a.life + i, _mm_sub_ps(_mm_loadu_ps(a.life + i), dt));
+    }
+    integrateParticlesScalar(a, i, end, deltaTime, speed);
+}
+
+//no FMA on purpose: a fused multiply-add rounds once and would not match the other kernels bit for bit
+PARTICLE_TARGET_AVX2
+void integrateParticlesAVX2(const ParticleArrays& a, size_t begin, size_t end, float deltaTime, float speed){
+    float distance = deltaTime * speed;
+    __m256 d = _mm256_set1_ps(distance);
+    __m256 dt = _mm256_set1_ps(deltaTime);
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8){
+        _mm256_storeu_ps(a.positionX + i, _mm256_add_ps(_mm256_loadu_ps(a.positionX + i), _mm256_mul_ps(d, _mm256_loadu_ps(a.directionX + i))));
+        _mm256_storeu_ps(a.positionY + i, _mm256_add_ps(_mm256_loadu_ps(a.positionY + i), _mm256_mul_ps(d, _mm256_loadu_ps(a.directionY + i))));
+        _mm256_storeu_ps(a.positionZ + i, _mm256_add_ps(_mm256_loadu_ps(a.positionZ + i), _mm256_mul_ps(d, _mm256_loadu_ps(a.directionZ + i))));
+        _mm256_storeu_ps(a.life + i, _mm256_sub_ps(_mm256_loadu_ps(a.life + i), dt));
+    }
+    integrateParticlesSSE(a, i, end, deltaTime, speed);
+}
+#endif
+
+//integrate the particles [begin, end) with the given kernel, it must be supported
+void integrateParticles(const ParticleArrays& a, size_t begin, size_t end, float deltaTime, float speed, ParticleKernel kernel){
+#ifdef PARTICLE_KERNEL_X86
+    if(kernel == PARTICLE_KERNEL_AVX2){
+        integrateParticlesAVX2(a, begin, end, deltaTime, speed);
+        return;
+    }
+    if(kernel == PARTICLE_KERNEL_SSE){
+        integrateParticlesSSE(a, begin, end, deltaTime, speed);
+        return;
+    }
+#endif
+    integrateParticlesScalar(a, begin, end, deltaTime, speed);
+}
+
+//same as integrateParticles, split between up to maxThreads threads (the calling thread included) for large counts
+void integrateParticlesParallel(const ParticleArrays& a, size_t begin, size_t end, float deltaTime, float speed,
+                                ParticleKernel kernel, unsigned int maxThreads){
+    size_t count = end - begin;
+    size_t threads = std::min<size_t>(maxThreads, count / PARTICLE_PARALLEL_CHUNK);
+    if(count < PARTICLE_PARALLEL_MIN || threads < 2){
+        integrateParticles(a, begin, end, deltaTime, speed, kernel);
+        return;
+    }
+
+    //chunks are multiples of 8 particles so every thread stays on the vector path
+    size_t chunk = ((count + threads - 1) / threads + 7) & ~(size_t)7;
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for(size_t t = 1; t < threads; t++){
+        size_t chunkBegin = std::min(end, begin + t * chunk);
+        size_t chunkEnd = std::min(end, chunkBegin + chunk);
+        workers.emplace_back([=, &a]{ integrateParticles(a, chunkBegin, chunkEnd, deltaTime, speed, kernel); });
+    }
+    integrateParticles(a, begin, std::min(end, begin + chunk), deltaTime, speed, kernel);
+    for(std::thread& worker : workers)
+        worker.join();
+}
+
+#endif
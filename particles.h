@@ -2,66 +2,269 @@
 #define PARTICLES_H
 
 #include <vector>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include "object.h"
 #include "shader.h"
-
-struct Particle {
-    glm::vec3 direction;
-    glm::vec3 position;
-    glm::mat4 model;
-    float life;
-};
+#include "glstate.h"
+#include "particlekernel.h"
+#include "bvh.h"
 
 const float PARTICLE_SPEED = 300.0f;
 const float PARTICLE_LIFE = 5.0f;
+const glm::vec3 PARTICLE_SCALE = glm::vec3(0.4f, 0.04f, 0.04f);
+
+//the model matrix of every particle is an instance attribute of PARTICLE.vert, it uses 4 locations
+#define PARTICLE_INSTANCE_LOC 4
+#define PARTICLE_MIN_INSTANCES 256 //first size of the instance buffer
+#define PARTICLE_CAPACITY 8192 //live particles, all the memory is allocated at startup
+
+//what addNew does when the pool is full
+enum ParticleOverflow {
+    PARTICLE_OVERFLOW_DROP_OLDEST,//the new particle replaces the oldest one
+    PARTICLE_OVERFLOW_REJECT//the new particle is not added
+};
+
+/* Fixed capacity store of the particles, one array per field.
+Every particle lives PARTICLE_LIFE seconds, so they die in the order they were added: the store is a ring buffer,
+new particles are added after the youngest one and the dead ones are removed from the oldest one.
+The live particles are at most two contiguous spans of the arrays, see span().
+*/
+class ParticlePool {
+public:
+    ParticlePool(size_t capacity = PARTICLE_CAPACITY, ParticleOverflow overflow = PARTICLE_OVERFLOW_DROP_OLDEST)
+        : capacity(capacity), overflow(overflow),
+          positionX(capacity), positionY(capacity), positionZ(capacity),
+          directionX(capacity), directionY(capacity), directionZ(capacity),
+          life(capacity), orientation(capacity) {
+    }
+
+    //false when the pool is full and the overflow policy is PARTICLE_OVERFLOW_REJECT
+    bool add(const glm::vec3& direction, const glm::vec3& position, const glm::mat3& orientation, float life){
+        if(count == capacity){
+            dropped++;
+            if(overflow == PARTICLE_OVERFLOW_REJECT)
+                return false;
+            removeOldest(1);
+        }
+        size_t i = (first + count) % capacity;
+        positionX[i] = position.x;
+        positionY[i] = position.y;
+        positionZ[i] = position.z;
+        directionX[i] = direction.x;
+        directionY[i] = direction.y;
+        directionZ[i] = direction.z;
+        this->life[i] = life;
+        this->orientation[i] = orientation;
+        count++;
+        return true;
+    }
+
+    //remove the particles dead after deltaTime, the oldest ones are the first to die
+    void removeDead(float deltaTime){
+        size_t dead = 0;
+        while(dead < count && life[(first + dead) % capacity] <= deltaTime)
+            dead++;
+        removeOldest(dead);
+    }
+
+    //move the live particles and age them by deltaTime, threads are only used for very large counts
+    void integrate(float deltaTime, float speed, ParticleKernel kernel = bestParticleKernel(), unsigned int maxThreads = 1){
+        ParticleArrays arrays = {positionX.data(), positionY.data(), positionZ.data(),
+                                 directionX.data(), directionY.data(), directionZ.data(), life.data()};
+        for(int s = 0; s < 2; s++){
+            size_t begin, end;
+            span(s, begin, end);
+            if(begin < end)
+                integrateParticlesParallel(arrays, begin, end, deltaTime, speed, kernel, maxThreads);
+        }
+    }
+
+    //the live particles are the indices [begin, end) of span 0 then of span 1 (often empty)
+    void span(int index, size_t& begin, size_t& end) const {
+        size_t firstSpan = std::min(count, capacity - first);
+        if(index == 0){
+            begin = first;
+            end = first + firstSpan;
+        }else{
+            begin = 0;
+            end = count - firstSpan;
+        }
+    }
+
+    //i-th live particle, 0 is the oldest
+    size_t index(size_t i) const {
+        return (first + i) % capacity;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    //particles dropped or rejected because the pool was full
+    size_t droppedCount() const {
+        return dropped;
+    }
+
+    const size_t capacity;
+    const ParticleOverflow overflow;
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> directionX, directionY, directionZ;
+    std::vector<float> life;//seconds left
+    std::vector<glm::mat3> orientation;//rotation of the plane when the particle was fired
+
+private:
+    size_t first = 0;//oldest live particle
+    size_t count = 0;
+    size_t dropped = 0;
 
-class Particles {
+    void removeOldest(size_t n){
+        first = (first + n) % capacity;
+        count -= n;
+        if(count == 0)
+            first = 0;//keep the particles in a single span when possible
+    }
+};
 
+//what the plane fires its particles into, simulated on the CPU (Particles) or on the GPU (GpuParticles)
+class ParticleEmitter {
 public:
+    virtual ~ParticleEmitter(){}
+    //model is the model matrix of the plane firing the particle, only its rotation is kept
+    virtual void addNew(glm::vec3 direction, glm::vec3 position, glm::mat4 model) = 0;
+};
+
+class Particles : public ParticleEmitter {
 
-    Particles(Shader *particleShader, Object *particleObject){
+public:
+
+    Particles(Shader *particleShader, Object *particleObject, ParticleOverflow overflow = PARTICLE_OVERFLOW_DROP_OLDEST)
+        : pool(PARTICLE_CAPACITY, overflow) {
         this->particleShader = particleShader;
         this->particleObject = particleObject;
+        instanceModels.reserve(PARTICLE_CAPACITY);
+        rays.reserve(PARTICLE_CAPACITY);
+        hits.reserve(PARTICLE_CAPACITY);
+    }
+
+    Particles(const Particles&) = delete;
+    Particles& operator=(const Particles&) = delete;
+
+    ~Particles(){
+        if(instanceBuffer){
+            glDeleteBuffers(1, &instanceBuffer);
+            GLState::instance().forgetBuffer(instanceBuffer);
+        }
     }
 
-    void addNew(glm::vec3 direction, glm::vec3 position, glm::mat4 model){
-        Particle * part = new Particle();
-        part->direction = direction;
-        part->position = position;
-        part->model = model;
-        part->life = PARTICLE_LIFE;
-        particles.push_back(*part);
+    void addNew(glm::vec3 direction, glm::vec3 position, glm::mat4 model) override {
+        pool.add(direction, position, glm::mat3(model), PARTICLE_LIFE);
     }
 
     void update(float deltaTime){
         //remove every dead particles
-        while(!particles.empty() && particles.front().life <= deltaTime)
-                particles.erase(particles.begin());
-        
+        pool.removeDead(deltaTime);
+
+        //a laser stops on the first thing it hits during this step
+        if(world)
+            collide(deltaTime);
+
         //update particles life and position
-        for(auto partIt = particles.begin(); partIt != particles.end(); ++ partIt){
-            partIt->life -= deltaTime;
-            partIt->position += (deltaTime * PARTICLE_SPEED) * partIt->direction;
-        }
+        pool.integrate(deltaTime, PARTICLE_SPEED, bestParticleKernel(), std::thread::hardware_concurrency());
     }
 
-    void draw(){
-        for(auto partIt = particles.begin(); partIt != particles.end(); ++ partIt){
-            glm::mat4 modelParticle = glm::mat4(1.0f);
-            modelParticle = glm::scale(modelParticle, glm::vec3(0.4f, 0.04f, 0.04f));
+    //every particle in one instanced draw, the particle shader must be in use.
+    //the particles are drawn where they were timeOffset seconds after the last update (negative to draw them between two steps)
+    void draw(float timeOffset = 0.0f){
+        writeInstances(instanceModels, timeOffset);
+        drawInstances(instanceModels);
+    }
 
-            glm::mat4 modelTransform = partIt->model;
-            modelTransform[3] = glm::vec4(partIt->position,1);
-            modelParticle =  modelTransform * modelParticle;
-            particleShader->setMatrix4("M", modelParticle);
-            particleObject->draw();
+    //the model matrix of every living particle, without OpenGL: the simulation thread writes them in the render snapshot
+    void writeInstances(std::vector<glm::mat4>& instanceModels, float timeOffset = 0.0f) const {
+        //rotation of the plane when the particle was fired, scaled and moved to the particle position
+        instanceModels.resize(pool.size());
+        size_t drawn = 0;
+        for(size_t n = 0; n < pool.size(); n++){
+            size_t i = pool.index(n);
+            if(pool.life[i] <= 0.0f)//hit something, removed with the older ones
+                continue;
+            const glm::mat3& orientation = pool.orientation[i];
+            glm::mat4& model = instanceModels[drawn++];
+            model[0] = glm::vec4(orientation[0] * PARTICLE_SCALE.x, 0.0f);
+            model[1] = glm::vec4(orientation[1] * PARTICLE_SCALE.y, 0.0f);
+            model[2] = glm::vec4(orientation[2] * PARTICLE_SCALE.z, 0.0f);
+            glm::vec3 move = glm::vec3(pool.directionX[i], pool.directionY[i], pool.directionZ[i]) * (timeOffset * PARTICLE_SPEED);
+            model[3] = glm::vec4(glm::vec3(pool.positionX[i], pool.positionY[i], pool.positionZ[i]) + move, 1.0f);
         }
+        instanceModels.resize(drawn);
     }
 
+    //one instanced draw of the models written by writeInstances
+    void drawInstances(const std::vector<glm::mat4>& instanceModels){
+        if(instanceModels.empty() || !particleObject->VAO)//the cube may not be uploaded yet
+            return;
+        if(instanceVAO != particleObject->VAO)
+            setupInstanceAttributes();
+
+        GLState::instance().bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if(instanceModels.size() > instanceCapacity)
+            instanceCapacity = std::max(instanceModels.size(), instanceCapacity * 2);
+        //orphan the storage used by the previous frame instead of waiting for the GPU to finish with it
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instanceModels.size() * sizeof(glm::mat4), instanceModels.data());
+
+        particleObject->drawInstanced(instanceModels.size());
+    }
+
+    const ParticlePool& getPool() const {
+        return pool;
+    }
+
+    //static geometry stopping the particles, none when null
+    const CollisionWorld* world = nullptr;
+
 private:
-    std::vector<Particle> particles;
+    ParticlePool pool;
     Shader *particleShader;
     Object *particleObject;
+    std::vector<glm::mat4> instanceModels;
+    GLuint instanceBuffer = 0;
+    size_t instanceCapacity = PARTICLE_MIN_INSTANCES;
+    GLuint instanceVAO = 0;//vertex array holding the instance attributes
+    std::vector<BVHRay> rays;//move of every live particle during the update
+    std::vector<BVHHit> hits;
+
+    //all the particle moves are tested in one batch, a particle hitting something dies where it hit
+    void collide(float deltaTime){
+        rays.resize(pool.size());
+        hits.assign(pool.size(), BVHHit());
+        for(size_t n = 0; n < pool.size(); n++){
+            size_t i = pool.index(n);
+            rays[n].origin = glm::vec3(pool.positionX[i], pool.positionY[i], pool.positionZ[i]);
+            rays[n].direction = glm::vec3(pool.directionX[i], pool.directionY[i], pool.directionZ[i]) * (deltaTime * PARTICLE_SPEED);
+            rays[n].maxDistance = pool.life[i] > 0.0f ? 1.0f : -1.0f;
+        }
+        world->intersectRays(rays.data(), rays.size(), hits.data());
+        for(size_t n = 0; n < pool.size(); n++){
+            if(hits[n].hit())
+                pool.life[pool.index(n)] = 0.0f;
+        }
+    }
+
+    //add the instance attributes to the vertex array of the particle object
+    void setupInstanceAttributes(){
+        GLState& state = GLState::instance();
+        if(!instanceBuffer)
+            glGenBuffers(1, &instanceBuffer);
+        state.bindVertexArray(particleObject->VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for(int column = 0; column < 4; column++){
+            glEnableVertexAttribArray(PARTICLE_INSTANCE_LOC + column);
+            glVertexAttribPointer(PARTICLE_INSTANCE_LOC + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * column));
+            glVertexAttribDivisor(PARTICLE_INSTANCE_LOC + column, 1);
+        }
+        instanceVAO = particleObject->VAO;
+    }
 };
-#endif
\ No newline at end of file
+#endif
@@ -3,13 +3,17 @@
 
 #include <glm/glm.hpp>
 #include "particles.h"
+#include "bvh.h"
+#include "timestep.h"
 
-//Default plane values
+//Default plane values, the speeds are per tick (see SIMULATION_TICK_RATE)
 const float PLANE_YAW = 70.0f;
 const float PLANE_PITCH = 0.0f;
 const float PLANE_SPEED = 0.5f;
 const float PLANE_ROLL = 0.0f;
 const float SHOOTING_COOLDOWN = 0.1f;
+const float PLANE_COLLISION_RADIUS = 2.0f;//sphere around the plane position tested against the world
+const float PLANE_COLLISION_SKIN = 0.01f;//distance kept from the surface after a contact
 
 
 // Defines several possible options for plane movement. Used as abstraction to stay away from window-system specific input methods
@@ -20,9 +24,18 @@ enum movementDirection {
     RIGHT
 };
 
+//what the simulation changes, kept for the interpolation between two steps
+struct PlaneTransform {
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+    float roll;
+};
+
 class Plane {
 public:
-    Particles *particles;
+    ParticleEmitter *particles;
+    const CollisionWorld *world = nullptr;//static geometry the plane can not go through, none when null
     glm::vec3 position;
     glm::vec3 front;
     glm::vec3 up;
@@ -38,24 +51,28 @@ public:
         this->position = position;
         this->yaw = yaw;
         this->pitch = pitch;
+        this->roll = roll;
         this->updateFront();
+        previousTransform = getTransform();
     }
 
 
  // processes input received from any keyboard-like input system. Accepts input parameter in the form of plane defined ENUM (to abstract it from windowing systems)
-    void processKeyboardMovement(movementDirection direction){
+    // deltaTime is the duration of the simulation step
+    void processKeyboardMovement(movementDirection direction, float deltaTime){
+        float ticks = deltaTime * SIMULATION_TICK_RATE;
         switch (direction){
         case UPWARD:
-            pitch -= 0.2f;
+            pitch -= 0.2f * ticks;
             break;
         case DOWNWARD:
-            pitch += 0.2f;
+            pitch += 0.2f * ticks;
             break;
         case LEFT:
-            roll += 0.4f;
+            roll += 0.4f * ticks;
             break;
         case RIGHT:
-            roll -= 0.4f;
+            roll -= 0.4f * ticks;
             break;
         }
 
@@ -79,19 +96,36 @@ public:
         }
     }
 
-    void updateState(){
-        //slowly go back to neutral position
+    //one step of the simulation, the state before it is kept for getInterpolatedTransform
+    void updateState(float deltaTime){
+        previousTransform = getTransform();
+        float ticks = deltaTime * SIMULATION_TICK_RATE;
+        //slowly go back to neutral position, 1/200 of the angle per tick
+        float decay = 1.0f - std::pow(1.0f - 1.0f / 200.0f, ticks);
         if(pitch != 0)
-            pitch -= pitch/200;
+            pitch -= pitch * decay;
 
         if(roll != 0){
-            float delta = roll/200;
+            float delta = roll * decay;
             roll -= delta;
             yaw -= delta;
         }
 
         this->updateFront();
-        this->position += this->front * speed;
+        move(this->front * speed * ticks);
+    }
+
+    PlaneTransform getTransform() const {
+        return {position, yaw, pitch, roll};
+    }
+
+    //between the state before the last step (alpha 0) and the current one (alpha 1), for the rendering
+    PlaneTransform getInterpolatedTransform(float alpha) const {
+        PlaneTransform current = getTransform();
+        return {glm::mix(previousTransform.position, current.position, alpha),
+                glm::mix(previousTransform.yaw, current.yaw, alpha),
+                glm::mix(previousTransform.pitch, current.pitch, alpha),
+                glm::mix(previousTransform.roll, current.roll, alpha)};
     }
 
 
@@ -110,13 +144,17 @@ public:
     -cos(r) sin(y)                       | sin(r)        | cos(r) cos(y)
     */
     glm::mat4 getModelMatrix(){
+        return getModelMatrix(getTransform());
+    }
 
-        float cosp = cos(glm::radians(pitch));
-        float cosy = cos(glm::radians(yaw));
-        float cosr = cos(glm::radians(roll));
-        float sinp = sin(glm::radians(pitch));
-        float siny = sin(glm::radians(yaw));
-        float sinr = sin(glm::radians(roll));
+    static glm::mat4 getModelMatrix(const PlaneTransform& transform){
+        const glm::vec3& position = transform.position;
+        float cosp = cos(glm::radians(transform.pitch));
+        float cosy = cos(glm::radians(transform.yaw));
+        float cosr = cos(glm::radians(transform.roll));
+        float sinp = sin(glm::radians(transform.pitch));
+        float siny = sin(glm::radians(transform.yaw));
+        float sinr = sin(glm::radians(transform.roll));
 
         float matrixArray[16] = {
             sinp*sinr*siny + cosp*cosy,  sinp*cosr,    cosp*siny - sinp*sinr*cosy,  0,
@@ -131,6 +169,23 @@ public:
 private:
 
     double lastShoot = 0;
+    PlaneTransform previousTransform;
+
+    //stop at the first contact and slide along the surface for the rest of the move
+    void move(glm::vec3 delta){
+        BVHHit hit;
+        if(!world || !world->sweepSphere(position, position + delta, PLANE_COLLISION_RADIUS, hit)){
+            position += delta;
+            return;
+        }
+        position += delta * hit.distance + hit.normal * PLANE_COLLISION_SKIN;
+        glm::vec3 slide = delta * (1.0f - hit.distance);
+        slide -= hit.normal * glm::dot(slide, hit.normal);
+        BVHHit slideHit;
+        if(world->sweepSphere(position, position + slide, PLANE_COLLISION_RADIUS, slideHit))
+            slide *= slideHit.distance;
+        position += slide;
+    }
     /* calculates the front and up vectors using the same method than getModelMatrix
         front: (1, 0, 0) => (cos(p) cos(y),    cos(p) sin(r) sin(y) + sin(p) cos(r),    cos(p) cos(r) sin(y) - sin(p) sin(r))
         up: (0, 1, 0) => (sin(p) (-cos(y)),    cos(p) cos(r) - sin(p) sin(r) sin(y),    -sin(p) cos(r) sin(y) - cos(p) sin(r))
@@ -3,77 +3,334 @@
 
 #include <glad/glad.h>
 
+#include <cstring>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "meshcache.h"
+#include "glstate.h"
+
+/* Program binary cache: a linked program is saved with glGetProgramBinary in PATH_TO_CACHE and loaded back
+with glProgramBinary at the next start. The key hashes the sources, the defines and the driver strings,
+a stale binary (or one refused by the driver after an update) is compiled again from the sources.
+
+Layout: ProgramCacheHeader then the binary
+*/
+#define PROGRAM_CACHE_MAGIC 0x47525043 //"CPRG"
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binarySize;
+};
+
+//location of an active uniform resolved once, set without any lookup. -1 when the uniform is not active.
+template<typename T>
+struct Uniform {
+    GLint location = -1;
+};
+
+//OpenGL type expected for each Uniform type, samplers are set as int
+template<typename T> bool isUniformType(GLenum type);
+template<> bool isUniformType<GLint>(GLenum type){ return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE; }
+template<> bool isUniformType<GLfloat>(GLenum type){ return type == GL_FLOAT; }
+template<> bool isUniformType<glm::vec3>(GLenum type){ return type == GL_FLOAT_VEC3; }
+template<> bool isUniformType<glm::mat4>(GLenum type){ return type == GL_FLOAT_MAT4; }
+
 class Shader{
 public:
 	GLuint ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath)
-	{
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try{
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }catch (std::ifstream::failure& e){
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
+    //lookups done by every Shader since the last resetLookupCounters, they should stay at 0 in the frame loop
+    static unsigned int& driverLookups(){ static unsigned int count = 0; return count; }//glGetUniformLocation calls
+    static unsigned int& nameLookups(){ static unsigned int count = 0; return count; }//uniforms set by name
+    static void resetLookupCounters(){
+        driverLookups() = 0;
+        nameLookups() = 0;
+    }
 
-        GLuint vertex = compileShader(vertexCode, GL_VERTEX_SHADER);
-        GLuint fragment = compileShader(fragmentCode, GL_FRAGMENT_SHADER);
-        ID = compileProgram(vertex, fragment);
+	//defines are lines like "#define NAME value\n" inserted after the #version of both shaders
+	Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
+	{
+        build({{vertexPath, GL_VERTEX_SHADER}, {fragmentPath, GL_FRAGMENT_SHADER}}, {}, defines);
 	}
 
+    //program with a geometry shader, geometryPath or fragmentPath can be null
+    //feedbackVaryings are the outputs captured (interleaved) by transform feedback, fragmentPath is null when only them are used
+    Shader(const char* vertexPath, const char* geometryPath, const char* fragmentPath,
+           const std::vector<std::string>& feedbackVaryings, const std::string& defines = "")
+    {
+        std::vector<std::pair<const char*, GLenum>> stages = {{vertexPath, GL_VERTEX_SHADER}};
+        if(geometryPath)
+            stages.push_back({geometryPath, GL_GEOMETRY_SHADER});
+        if(fragmentPath)
+            stages.push_back({fragmentPath, GL_FRAGMENT_SHADER});
+        build(stages, feedbackVaryings, defines);
+    }
+
+    //compute program (OpenGL 4.3)
+    explicit Shader(const char* computePath, const std::string& defines)
+    {
+        build({{computePath, GL_COMPUTE_SHADER}}, {}, defines);
+    }
+
     Shader(std::string vShaderCode, std::string fShaderCode)
     {
         GLuint vertex = compileShader(vShaderCode, GL_VERTEX_SHADER);
         GLuint fragment = compileShader(fShaderCode, GL_FRAGMENT_SHADER);
-        ID = compileProgram(vertex, fragment);
+        ID = compileProgram({vertex, fragment}, {});
+        reflectUniforms();
     }
 
     void use() {
-        glUseProgram(ID);
+        GLState::instance().useProgram(ID);
+    }
+
+    //resolve a uniform once, outside of the frame loop
+    template<typename T>
+    Uniform<T> getUniform(const GLchar* name) {
+        Uniform<T> uniform;
+        auto it = uniforms.find(name);
+        if(it == uniforms.end()){
+            std::cout << "Uniform " << name << " is not active in program " << ID << std::endl;
+            return uniform;
+        }
+        if(!isUniformType<T>(it->second.type))
+            std::cout << "Uniform " << name << " of program " << ID << " does not have the requested type" << std::endl;
+        uniform.location = it->second.location;
+        return uniform;
+    }
+
+    //int and float values already set in the program are skipped by GLState
+    void set(Uniform<GLint> uniform, GLint value) {
+        GLState::instance().uniform1i(uniform.location, value);
+    }
+    void set(Uniform<GLfloat> uniform, GLfloat value) {
+        GLState::instance().uniform1f(uniform.location, value);
+    }
+    void set(Uniform<glm::vec3> uniform, const glm::vec3& value) {
+        glUniform3f(uniform.location, value.x, value.y, value.z);
     }
+    void set(Uniform<glm::mat4> uniform, const glm::mat4& matrix) {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(matrix));
+    }
+
+    //location from the reflected uniforms, -1 if the uniform is not active
+    GLint getUniformLocation(const GLchar* name) {
+        nameLookups()++;
+        auto it = uniforms.find(name);
+        if(it != uniforms.end())
+            return it->second.location;
+        //every other uniform is reflected, only the array elements after the first one are missing
+        if(!strchr(name, '['))
+            return -1;
+        driverLookups()++;
+        GLint location = glGetUniformLocation(ID, name);
+        uniforms[name] = {location, GL_NONE};
+        return location;
+    }
+
+    //connect a uniform block of the program to a buffer binding point, false if the program does not use the block
+    bool bindUniformBlock(const GLchar* name, GLuint binding) {
+        GLuint blockIndex = glGetUniformBlockIndex(ID, name);
+        if(blockIndex == GL_INVALID_INDEX)
+            return false;
+        glUniformBlockBinding(ID, blockIndex, binding);
+        return true;
+    }
+
+    //setters by name, for the uniforms set once, the frame loop uses getUniform and set
     void setInteger(const GLchar *name, GLint value) {
-        glUniform1i(glGetUniformLocation(ID, name), value);
+        GLState::instance().uniform1i(getUniformLocation(name), value);
     }
     void setFloat(const GLchar* name, GLfloat value) {
-        glUniform1f(glGetUniformLocation(ID, name), value);
+        GLState::instance().uniform1f(getUniformLocation(name), value);
     }
     void setVector3f(const GLchar* name, GLfloat x, GLfloat y, GLfloat z) {
-        glUniform3f(glGetUniformLocation(ID, name), x, y, z);
+        glUniform3f(getUniformLocation(name), x, y, z);
     }
     void setVector3f(const GLchar* name, const glm::vec3& value) {
-        glUniform3f(glGetUniformLocation(ID, name), value.x, value.y, value.z);
+        glUniform3f(getUniformLocation(name), value.x, value.y, value.z);
     }
     void setMatrix4(const GLchar* name, const glm::mat4& matrix) {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name), 1, GL_FALSE, glm::value_ptr(matrix));
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, glm::value_ptr(matrix));
     }
 
 private:
+    //read, compile and link the stages (path and shader type), or load the program from the cache
+    void build(const std::vector<std::pair<const char*, GLenum>>& stages, const std::vector<std::string>& feedbackVaryings,
+               const std::string& defines){
+        std::vector<std::string> codes, paths;
+        for(auto& stage : stages){
+            codes.push_back(insertDefines(readShaderFile(stage.first), defines));
+            paths.push_back(stage.first);
+        }
+
+        std::string cachePath = programCachePath(paths, defines);
+        uint64_t key = programKey(codes, feedbackVaryings);
+        ID = loadProgramBinary(cachePath, key);
+        if(ID){
+            std::cout << "Loaded program from cache " << cachePath << std::endl;
+        }else{
+            std::vector<GLuint> shaders;
+            for(size_t i = 0; i < stages.size(); i++)
+                shaders.push_back(compileShader(codes[i], stages[i].second));
+            ID = compileProgram(shaders, feedbackVaryings);
+            saveProgramBinary(cachePath, key);
+        }
+        reflectUniforms();
+    }
+
+    static std::string readShaderFile(const char* path){
+        std::ifstream shaderFile;
+        // ensure ifstream objects can throw exceptions:
+        shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try{
+            shaderFile.open(path);
+            std::stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
+            return shaderStream.str();
+        }catch (std::ifstream::failure& e){
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << " " << e.what() << std::endl;
+        }
+        return "";
+    }
+
+    struct UniformInfo {
+        GLint location;
+        GLenum type;
+    };
+    std::unordered_map<std::string, UniformInfo> uniforms;
+
+    //fill the uniform table with every active uniform of the linked program
+    void reflectUniforms(){
+        GLint numUniforms = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &numUniforms);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(std::max(maxLength, 1));
+        for(GLint i = 0; i < numUniforms; i++){
+            GLint size;
+            GLenum type;
+            GLsizei length;
+            glGetActiveUniform(ID, i, name.size(), &length, &size, &type, name.data());
+            std::string uniformName(name.data(), length);
+            GLint location = glGetUniformLocation(ID, uniformName.c_str());
+            if(location < 0)
+                continue;//uniforms of a block have no location
+            uniforms[uniformName] = {location, type};
+            //arrays are reported as "name[0]", they can also be set as "name"
+            if(uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+                uniforms[uniformName.substr(0, uniformName.size() - 3)] = {location, type};
+        }
+    }
+
+    //program binaries are only available from OpenGL 4.1 or with ARB_get_program_binary
+    static bool canUseProgramBinaries(){
+        if(!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+            return false;
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        return numFormats > 0;
+    }
+
+    static std::string insertDefines(const std::string& code, const std::string& defines){
+        if(defines.empty())
+            return code;
+        //#version must stay the first line
+        std::string::size_type lineEnd = code.compare(0, 8, "#version") == 0 ? code.find('\n') : std::string::npos;
+        if(lineEnd == std::string::npos)
+            return defines + "\n" + code;
+        return code.substr(0, lineEnd + 1) + defines + "\n" + code.substr(lineEnd + 1);
+    }
+
+    //one file per set of shaders and defines: "LIGHT.vert.LIGHT.frag.<hash of the defines>.program"
+    static std::string programCachePath(const std::vector<std::string>& shaderPaths, const std::string& defines){
+        std::ostringstream path;
+        path << PATH_TO_CACHE "/";
+        for(const std::string& shaderPath : shaderPaths)
+            path << shaderPath.substr(shaderPath.find_last_of("/\\") + 1) << ".";
+        path << std::hex << hashBytes(defines.data(), defines.size()) << ".program";
+        return path.str();
+    }
+
+    //the binary is only valid for the same sources (defines included), transform feedback outputs and driver
+    static uint64_t programKey(const std::vector<std::string>& codes, const std::vector<std::string>& feedbackVaryings){
+        uint64_t key = 0xcbf29ce484222325ULL;
+        for(const std::string& code : codes)
+            key = hashBytes(code.data(), code.size(), key);
+        for(const std::string& varying : feedbackVaryings)
+            key = hashBytes(varying.c_str(), varying.size() + 1, key);
+        GLenum strings[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        for(GLenum name : strings){
+            const char* value = (const char*) glGetString(name);
+            if(value)
+                key = hashBytes(value, strlen(value), key);
+        }
+        return key;
+    }
+
+    //returns 0 when there is no valid binary, the caller then compiles the sources
+    GLuint loadProgramBinary(const std::string& cachePath, uint64_t key){
+        if(!canUseProgramBinaries())
+            return 0;
+        MappedFile file;
+        if(!file.open(cachePath) || file.size() < sizeof(ProgramCacheHeader))
+            return 0;
+        const ProgramCacheHeader* header = (const ProgramCacheHeader*) file.data();
+        if(header->magic != PROGRAM_CACHE_MAGIC || header->version != PROGRAM_CACHE_VERSION || header->key != key
+            || file.size() < sizeof(ProgramCacheHeader) + header->binarySize)
+            return 0;
+
+        GLuint programID = glCreateProgram();
+        glProgramBinary(programID, header->binaryFormat, file.data() + sizeof(ProgramCacheHeader), header->binarySize);
+        GLint success;
+        glGetProgramiv(programID, GL_LINK_STATUS, &success);
+        if(!success){
+            //the driver can refuse a binary for reasons not in the key
+            glDeleteProgram(programID);
+            return 0;
+        }
+        return programID;
+    }
+
+    void saveProgramBinary(const std::string& cachePath, uint64_t key){
+        GLint success, binarySize = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if(!success || !canUseProgramBinaries())
+            return;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+        if(binarySize <= 0)
+            return;
+
+        std::vector<char> binary(binarySize);
+        GLenum binaryFormat;
+        glGetProgramBinary(ID, binarySize, NULL, &binaryFormat, binary.data());
+
+        ProgramCacheHeader header = {};
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = key;
+        header.binaryFormat = binaryFormat;
+        header.binarySize = binarySize;
+        MeshCacheWriter writer;
+        if(!writer.open(cachePath, header))
+            return;
+        writer.write(binary.data(), binary.size());
+        if(!writer.close())
+            std::cout << "Can not write program cache " << cachePath << std::endl;
+    }
+
     GLuint compileShader(std::string shaderCode, GLenum shaderType)
     {
         GLuint shader = glCreateShader(shaderType);
@@ -94,17 +351,32 @@ private:
             else if (shaderType == GL_FRAGMENT_SHADER) {
                 t = "fragment shader";
             }
+            else if (shaderType == GL_GEOMETRY_SHADER) {
+                t = "geometry shader";
+            }
+            else if (shaderType == GL_COMPUTE_SHADER) {
+                t = "compute shader";
+            }
             std::cout << "ERROR::SHADER_COMPILATION_ERROR of the " << t << ": " << shaderType << infoLog << std::endl;
         }
         return shader;
     }
 
-    GLuint compileProgram(GLuint vertexShader, GLuint fragmentShader)
+    GLuint compileProgram(const std::vector<GLuint>& shaders, const std::vector<std::string>& feedbackVaryings)
     {
         GLuint programID = glCreateProgram();
+        if(canUseProgramBinaries())
+            glProgramParameteri(programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
-        glAttachShader(programID, vertexShader);
-        glAttachShader(programID, fragmentShader);
+        for(GLuint shader : shaders)
+            glAttachShader(programID, shader);
+        //the captured outputs must be known before linking
+        if(!feedbackVaryings.empty()){
+            std::vector<const GLchar*> names;
+            for(const std::string& varying : feedbackVaryings)
+                names.push_back(varying.c_str());
+            glTransformFeedbackVaryings(programID, names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+        }
         glLinkProgram(programID);
 
 
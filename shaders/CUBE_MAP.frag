@@ -4,8 +4,25 @@ precision mediump float;
 		//Get the cube map
 uniform samplerCube cubemapSampler; 
 in vec3 texCoord_v; 
-uniform vec3 light_pos; 
-uniform float timeOfDay;
+
+//shared by all the programs, must match FrameData and LightData in uniformbuffers.h
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float timeOfDay;
+} frame;
+
+layout(std140) uniform LightData {
+    vec3 light_pos;
+    float ambient_strength;
+    float diffuse_strength;
+    float specular_strength;
+    float constant;
+    float linear;
+    float quadratic;
+} light;
 
 const vec4 lavaColor = vec4(0.7f, 0.1f, 0.1f, 1.0f);
 
@@ -16,19 +33,19 @@ void main() {
     if(texCoord_v.y < 0){//ground
         FragColor = lavaColor;
     }else{
-        if(timeOfDay >= 0.0f){
-            vec3 L = normalize(light_pos);
+        if(frame.timeOfDay >= 0.0f){
+            vec3 L = normalize(light.light_pos);
             vec3 D = normalize(texCoord_v);
             float angle = dot(L , D);
             angle = max(angle,0);
             float spec = pow(angle, 32); 
             vec4 color = texture(cubemapSampler, texCoord_v);
-            vec3 color_sun = spec * (vec3(1,1,1) - color.xyz) + color.xyz  * min(timeOfDay*2, 1); 
-            color_sun = mix(color_sun.xyz, neutralColor, 1-timeOfDay); 
+            vec3 color_sun = spec * (vec3(1,1,1) - color.xyz) + color.xyz  * min(frame.timeOfDay*2, 1); 
+            color_sun = mix(color_sun.xyz, neutralColor, 1-frame.timeOfDay); 
             FragColor = vec4(color_sun.xyz,color.w); 
         }else{
             vec4 color = texture(cubemapSampler, texCoord_v);
-            vec3 color_night = mix(color.xyz, neutralColor, 1+timeOfDay); 
+            vec3 color_night = mix(color.xyz, neutralColor, 1+frame.timeOfDay); 
             FragColor = vec4(color_night.xyz,color.w); 
         }
     }
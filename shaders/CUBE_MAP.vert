@@ -1,16 +1,22 @@
 #version 330 core
 layout(location = 0) in vec3 position; 		
 		//only P and V are necessary
-uniform mat4 V; 
-uniform mat4 P; 
+//shared by all the programs, must match FrameData in uniformbuffers.h
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float timeOfDay;
+} frame;
 out vec3 texCoord_v; 
 
 void main(){ 
 	texCoord_v = position ;
 			//remove translation info from view matrix to only keep rotation
-	mat4 V_rot = mat4(mat3(V)) ;
+	mat4 V_rot = mat4(mat3(frame.view)) ;
 			//Compute the position of the cube map
-	vec4 pos = P*V_rot*vec4(position,1.0); 
+	vec4 pos = frame.projection*V_rot*vec4(position,1.0); 
 			// the positions xyz are divided by w after the vertex shader
 			// the z component is equal to the depth value
 			// we want a z always equal to 1.0 here, so we set z = w!
@@ -6,8 +6,18 @@ in vec3 v_frag_coord;
 in vec2 v_text_coord; 
 in vec3 v_normal; 
 in vec3 v_tangent;
+flat in uint v_material;
 
-struct Light{ 
+//shared by all the programs, must match FrameData and LightData in uniformbuffers.h
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	vec4 cameraPosition;
+	float timeOfDay;
+} frame;
+
+layout(std140) uniform LightData { 
 	vec3 light_pos; 
 	float ambient_strength; 
 	float diffuse_strength; 
@@ -16,7 +26,7 @@ struct Light{
 	float constant;
 	float linear;
 	float quadratic;
-};
+} light;
 
 layout (binding = 0) uniform sampler2D ourTexture;
 layout (binding = 1) uniform sampler2D ourSpecularMap;
@@ -26,8 +36,30 @@ uniform bool hasTexture = false;
 uniform bool hasSpecularMap = false;
 uniform bool hasNormalMap = false;
 
-uniform vec3 u_view_pos; 
-uniform Light light;
+//packed objects read their textures in the layers of the material arrays, one array per texture size, see materialarrays.h
+layout (binding = 3) uniform sampler2DArray materialLayers[4];
+uniform bool packedMaterials = false;
+
+//must match MaterialTableEntry and MATERIAL_TABLE_BINDING in materialarrays.h
+struct MaterialEntry {
+	vec4 diffuse;//scale and offset of the coordinates in the layer
+	vec4 specular;
+	vec4 normal;
+	ivec4 layers;//diffuse, specular and normal, -1 without texture
+	ivec4 arrays;//in materialLayers
+	vec4 maxLods;//highest mip level of the diffuse, specular and normal textures
+};
+layout(std140, binding = 2) uniform MaterialTable {
+	MaterialEntry materials[64];
+} table;
+
+//textures of the fragment, from the material of the object or from the MaterialTable
+bool useTexture;
+bool useSpecularMap;
+bool useNormalMap;
+vec4 textureColor;
+float specularMapValue;
+vec3 normalMapValue;
 
 const vec4 fogColor = vec4(0.28f, 0.19f, 0.12f, 1.0f);
 const vec4 lavaColor = vec4(0.7f, 0.1f, 0.1f, 1.0f);
@@ -40,8 +72,8 @@ float specularCalculation(vec3 N, vec3 L, vec3 V ){
 	float strength = light.specular_strength;
 
 	float specularExponent = 32.0f;
-	if(hasSpecularMap){
- 		specularExponent = texture(ourSpecularMap, v_text_coord).r *255.0f;
+	if(useSpecularMap){
+ 		specularExponent = specularMapValue *255.0f;
 	}else{//reduce specular strength for other objects
 		strength = strength/2.0f;
 	}
@@ -68,28 +100,87 @@ float getLavaAmbientLight(){
 	return 0.0f;
 }
 
+//the gradients are shortened when they would select a level above maxLod
+vec4 sampleArray(sampler2DArray layers, vec3 coord, float maxLod, vec2 dx, vec2 dy){
+	vec2 size = vec2(textureSize(layers, 0).xy);
+	float lod = log2(max(length(dx * size), length(dy * size)));
+	if(lod > maxLod){
+		float shorten = exp2(maxLod - lod);
+		dx *= shorten;
+		dy *= shorten;
+	}
+	return textureGrad(layers, coord, dx, dy);
+}
+
+//the coordinates wrap inside the rectangle of the texture, the gradients of the unwrapped ones keep the mipmap
+//selection continuous across the wrap. The array of a material is not uniform over a draw: materialLayers is
+//only indexed by constants
+vec4 sampleLayer(int array, vec4 transform, int layer, float maxLod, vec2 dx, vec2 dy){
+	vec3 coord = vec3(fract(v_text_coord) * transform.xy + transform.zw, layer);
+	dx *= transform.xy;
+	dy *= transform.xy;
+	if(array == 1)
+		return sampleArray(materialLayers[1], coord, maxLod, dx, dy);
+	if(array == 2)
+		return sampleArray(materialLayers[2], coord, maxLod, dx, dy);
+	if(array == 3)
+		return sampleArray(materialLayers[3], coord, maxLod, dx, dy);
+	return sampleArray(materialLayers[0], coord, maxLod, dx, dy);
+}
+
+void readTextures(){
+	if(!packedMaterials){
+		useTexture = hasTexture;
+		useSpecularMap = hasSpecularMap;
+		useNormalMap = hasNormalMap;
+		textureColor = useTexture ? texture(ourTexture, v_text_coord) : vec4(0.0f);
+		specularMapValue = useSpecularMap ? texture(ourSpecularMap, v_text_coord).r : 0.0f;
+		normalMapValue = useNormalMap ? texture(ourNormalMap, v_text_coord).xyz : vec3(0.0f);
+		return;
+	}
+	//derivatives outside of the flow depending on the material
+	vec2 dx = dFdx(v_text_coord);
+	vec2 dy = dFdy(v_text_coord);
+	useTexture = useSpecularMap = useNormalMap = false;
+	if(v_material >= 64u)
+		return;
+	MaterialEntry material = table.materials[v_material];
+	useTexture = material.layers.x >= 0;
+	useSpecularMap = material.layers.y >= 0;
+	useNormalMap = material.layers.z >= 0;
+	if(useTexture)
+		textureColor = sampleLayer(material.arrays.x, material.diffuse, material.layers.x, material.maxLods.x, dx, dy);
+	if(useSpecularMap)
+		specularMapValue = sampleLayer(material.arrays.y, material.specular, material.layers.y, material.maxLods.y, dx, dy).r;
+	if(useNormalMap)
+		normalMapValue = sampleLayer(material.arrays.z, material.normal, material.layers.z, material.maxLods.z, dx, dy).xyz;
+}
+
 void main() { 
+	readTextures();
 	vec3 N = normalize(v_normal);
-	if(hasNormalMap){
+	if(useNormalMap){
 		vec3 T = normalize(v_tangent);
 		T = normalize(T - dot(T,N) * N);
 		vec3 B = cross(T,N);
-		vec3 bumpMapNormal = texture(ourNormalMap, v_text_coord).xyz;
-		bumpMapNormal = 2.0*bumpMapNormal - vec3(1.0, 1.0, 1.0);
+		//z is rebuilt from x and y, the cooked normal maps (BC5) only keep these two
+		vec3 bumpMapNormal;
+		bumpMapNormal.xy = 2.0*normalMapValue.xy - vec2(1.0, 1.0);
+		bumpMapNormal.z = sqrt(max(1.0 - dot(bumpMapNormal.xy, bumpMapNormal.xy), 0.0));
 		mat3 TBN = mat3(T, B, N);
 		vec3 newNormal = TBN* bumpMapNormal;
 		N = normalize(newNormal);
 	}
 	vec3 L = normalize(light.light_pos - v_frag_coord); 
-	vec3 V = normalize(u_view_pos - v_frag_coord); 
+	vec3 V = normalize(frame.cameraPosition.xyz - v_frag_coord); 
 	float specular = specularCalculation( N, L, V); 
 	float diffuse = light.diffuse_strength * max(dot(N,L),0.0);
 	float distance = length(light.light_pos - v_frag_coord);
 	float attenuation = 1 / (light.constant + light.linear * distance + light.quadratic * distance * distance);
 
 	vec4 materialColor = vec4(0.5f,0.5f,0.5f,1.0f);//default to grey
-	if(hasTexture){
-		materialColor = texture(ourTexture, v_text_coord);
+	if(useTexture){
+		materialColor = textureColor;
 	}
 
 	vec3 light = (light.ambient_strength + attenuation * (diffuse + specular)) * vec3(1.0f)  + getLavaAmbientLight() * lavaColor.xyz;
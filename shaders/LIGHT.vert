@@ -3,17 +3,26 @@ layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal; 
 layout(location = 2) in vec2 textureCoord; 
 layout(location = 3) in vec3 tangent; 
+layout(location = 4) in uint material; //index in the MaterialTable, only with packedMaterials
 
 out vec3 v_frag_coord; 
 out vec2 v_text_coord; 
 out vec3 v_normal; 
 out vec3 v_tangent;
+flat out uint v_material;
 out float visibility;
 
 uniform mat4 M; 
 uniform mat4 itM; 
-uniform mat4 V; 
-uniform mat4 P; 
+
+//shared by all the programs, must match FrameData in uniformbuffers.h
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float timeOfDay;
+} frame;
 
 const float fogDensity = 0.0012f;
 const float gradient = 1.0f;
@@ -24,7 +33,8 @@ void main(){
     v_text_coord = textureCoord;
     v_normal = vec3(itM * vec4(normal, 1.0)); 
     v_tangent = tangent;
-    gl_Position = P*V*frag_coord; 
+    v_material = material;
+    gl_Position = frame.viewProjection*frag_coord; 
 
     float distance = gl_Position.z;
     visibility = exp(-pow(distance * fogDensity, gradient));
@@ -1,11 +1,18 @@
 #version 330 core
 layout(location = 0) in vec3 position; 
+//one per particle, see PARTICLE_INSTANCE_LOC in particles.h
+layout(location = 4) in mat4 instanceModel;
 
-uniform mat4 M; 
-uniform mat4 V; 
-uniform mat4 P;
+//shared by all the programs, must match FrameData in uniformbuffers.h
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float timeOfDay;
+} frame;
 
 
 void main(){
-    gl_Position = P*V*M*vec4(position, 1);
+    gl_Position = frame.viewProjection*instanceModel*vec4(position, 1);
 };
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 330 core
+//one GpuParticle of gpuparticles.h, expanded to a box by PARTICLE_GPU.geom
+layout(location = 0) in vec4 positionLife;
+layout(location = 1) in vec3 direction;
+layout(location = 2) in vec3 axisX;
+layout(location = 3) in vec3 axisY;
+
+out vec3 v_position;
+out vec3 v_axisX;
+out vec3 v_axisY;
+
+//the particles are drawn between two updates, see GpuParticles::draw
+uniform float speed;
+uniform float timeOffset;
+
+void main(){
+    v_position = positionLife.xyz + (timeOffset * speed) * direction;
+    v_axisX = axisX;
+    v_axisY = axisY;
+}
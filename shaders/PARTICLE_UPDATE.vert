@@ -0,0 +1,21 @@
+#version 330 core
+//one GpuParticle of gpuparticles.h
+layout(location = 0) in vec4 positionLife;
+layout(location = 1) in vec3 direction;
+layout(location = 2) in vec3 axisX;
+layout(location = 3) in vec3 axisY;
+
+out vec4 v_positionLife;
+out vec3 v_direction;
+out vec3 v_axisX;
+out vec3 v_axisY;
+
+uniform float deltaTime;
+uniform float speed;
+
+void main(){
+    v_positionLife = vec4(positionLife.xyz + (deltaTime * speed) * direction, positionLife.w - deltaTime);
+    v_direction = direction;
+    v_axisX = axisX;
+    v_axisY = axisY;
+}
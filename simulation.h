@@ -0,0 +1,173 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "plane.h"
+#include "particles.h"
+#include "gpuparticles.h"
+#include "timestep.h"
+#include "uniformbuffers.h"
+
+/* The game state advanced on the simulation thread of the FramePipeline (see framepipeline.h).
+The render thread reads the keys with GLFW and sends them with the time of the frame (FrameInput), the
+simulation runs the fixed steps up to that time and writes everything the frame draws in a RenderSnapshot:
+the plane interpolated at the frame time, the light, the model of every CPU particle and the particles fired
+for the GPU particles. After the pipeline starts, the plane and the CPU particles are only used by the simulation.
+The camera stays on the render thread, it follows the mouse events.
+*/
+
+//keys of the plane held during the frame
+struct PlaneInput {
+    bool up = false;
+    bool down = false;
+    bool left = false;
+    bool right = false;
+    bool shoot = false;//held or clicked since the last frame
+};
+
+struct FrameInput {
+    double time = 0.0;//glfwGetTime of the frame
+    PlaneInput plane;
+};
+
+struct RenderSnapshot {
+    double time = 0.0;//of the FrameInput
+    PlaneTransform plane;//interpolated at the time of the frame
+    glm::vec3 planePosition;//after the last step, for the world streaming
+    glm::vec3 planeFront;
+    float timeOfDay = 0.0f;//sinus of the day cycle: positive during the day, negative at night
+    LightData light;
+    std::vector<glm::mat4> particles;//CPU particles at the time of the frame
+    //GPU particles: the OpenGL thread adds the ones fired by every step and updates them
+    std::vector<GpuParticleRecorder::Record> firedParticles;
+    int steps = 0;
+    float stepTime = 0.0f;
+    float particleTimeOffset = 0.0f;//from the last step to the time of the frame, negative
+};
+
+class Simulation {
+public:
+    //particles is null when the particles are simulated on the GPU
+    Simulation(Plane& plane, Particles* particles, double rate = SIMULATION_HZ)
+        : plane(plane), particles(particles), timestep(rate) {
+        //the particles fired for the GPU are recorded for the render thread
+        if(particles)
+            plane.particles = particles;
+        else
+            plane.particles = &recorder;
+        //the lasers stop on the scenery the plane collides with
+        recorder.world = plane.world;
+    }
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    //the steps from the previous frame to input.time
+    void run(const FrameInput& input, RenderSnapshot& snapshot){
+        if(!started){
+            lastTime = input.time;
+            started = true;
+        }
+        int steps = timestep.advance(input.time - lastTime);
+        lastTime = input.time;
+        float step = timestep.stepTime();
+
+        recorder.records.clear();
+        pendingShot = pendingShot || input.plane.shoot;
+        for(int i = 0; i < steps; i++){
+            recorder.step = i;
+            applyInput(input.plane, step);
+            plane.updateState(step);
+            if(particles)
+                particles->update(step);
+            time += step;
+        }
+        float alpha = timestep.alpha();
+
+        snapshot.time = input.time;
+        snapshot.plane = plane.getInterpolatedTransform(alpha);
+        snapshot.planePosition = plane.position;
+        snapshot.planeFront = plane.front;
+        snapshot.steps = steps;
+        snapshot.stepTime = step;
+        snapshot.particleTimeOffset = (alpha - 1.0f) * step;
+        if(particles)
+            particles->writeInstances(snapshot.particles, snapshot.particleTimeOffset);
+        else
+            snapshot.particles.clear();
+        snapshot.firedParticles.swap(recorder.records);
+        computeLight(input.time, snapshot);
+    }
+
+private:
+    Plane& plane;
+    Particles* particles;
+    GpuParticleRecorder recorder;
+    FixedTimestep timestep;
+    bool started = false;
+    double lastTime = 0.0;//of the previous frame
+    double time = 0.0;//simulated
+    bool pendingShot = false;//a click waits for the next step
+
+    //values of the light at noon and at night
+    const float ambientDay = 0.5;
+    const float ambientNight = 0.2;
+    const float diffuseDay = 0.5;
+    const float diffuseNight = 0.2;
+    const float specularDay = 0.5;
+    const float specularNight = 0.5;
+    const int timeSlowdown = 20;
+    const glm::vec3 lightOrigin = glm::vec3(0.0f, 0.1f, 0.0f);
+
+    void applyInput(const PlaneInput& input, float deltaTime){
+        if(input.left)
+            plane.processKeyboardMovement(LEFT, deltaTime);
+        if(input.right)
+            plane.processKeyboardMovement(RIGHT, deltaTime);
+        if(input.up)
+            plane.processKeyboardMovement(UPWARD, deltaTime);
+        if(input.down)
+            plane.processKeyboardMovement(DOWNWARD, deltaTime);
+        if(pendingShot){
+            plane.shoot(time);
+            pendingShot = false;
+        }
+    }
+
+    //the sun turns around the world, the moon replaces it at night
+    void computeLight(double realTime, RenderSnapshot& snapshot){
+        double now = (realTime + 3.14 * timeSlowdown) / timeSlowdown;//add constant to start at night
+        float sinTime = std::sin(now);
+
+        glm::vec3 position = lightOrigin + glm::vec3(5000.0 * std::cos(now), 5000.0 * sinTime, 0.0);//Put the sun far away
+        float ambient = ambientDay;
+        float diffuse = diffuseDay;
+        float specular = specularDay;
+        if(sinTime < 0){//night
+            position = glm::vec3(5000.0 * 0.75, 0.0, 5000.0 * 1);//position of moon
+            ambient = ambientNight;
+            diffuse = diffuseNight;
+            specular = specularNight;
+        }else if(sinTime < 0.2f){//sunset or sunrise
+            float sunProgress = sinTime / 0.2f;
+            diffuse = diffuseNight + sunProgress * (diffuseDay - diffuseNight);
+            ambient = ambientNight + sunProgress * (ambientDay - ambientNight);
+            specular = specularNight + sunProgress * (specularDay - specularNight);
+        }
+
+        snapshot.timeOfDay = sinTime;
+        snapshot.light = LightData();
+        snapshot.light.light_pos = position;
+        snapshot.light.ambient_strength = ambient;
+        snapshot.light.diffuse_strength = diffuse;
+        snapshot.light.specular_strength = specular;
+        snapshot.light.constant = 1.0f;//no attenuation for sun light
+        snapshot.light.linear = 0.0f;
+        snapshot.light.quadratic = 0.0f;
+    }
+};
+
+#endif
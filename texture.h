@@ -2,7 +2,17 @@
 #define TEXTURE_H
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <iostream>
 #include "stb_image.h"
+#include "meshcache.h"
+#include "texturecook.h"
+#include "glstate.h"
 
 class Texture {
 
@@ -11,17 +21,63 @@ public:
         this->fileName = fileName;
     }
 
+    //the OpenGL name is owned, a Texture is shared through TextureCache instead of copied
+    Texture(const Texture&) = delete;
+    Texture& operator=(const Texture&) = delete;
+
+    //must run on the OpenGL thread when the texture was uploaded
+    ~Texture(){
+        if (textureObj) {
+            glDeleteTextures(1, &textureObj);
+            GLState::instance().forgetTexture(textureObj);
+        }
+        stbi_image_free(data);
+    }
+
+    //decode then upload, both on the calling thread
     bool load(GLenum textureUnit){
+        return decode() && upload(textureUnit);
+    }
 
-        glGenTextures(1, &textureObj);
-        glActiveTexture(textureUnit);
-        glBindTexture(GL_TEXTURE_2D, textureObj);
+    //read the image file into memory, does not need an OpenGL context and can run on any thread
+    //a texture shared by several materials is only decoded once
+    bool decode(){
+        std::lock_guard<std::mutex> lock(mutex);
+        if (data || cooked.isValid() || textureObj)
+            return true;
 
-        stbi_set_flip_vertically_on_load(true);
-        int imWidth, imHeight, imNrChannels;
-        unsigned char* data = stbi_load(fileName.c_str(), &imWidth, &imHeight, &imNrChannels, 0);
+        //prefer the compressed mip chain made by --cook
+        if (readCookedTexture(cookedTexturePath(fileName), hashFile(fileName), 1, cooked))
+            return true;
 
-        if (data){
+        //thread local flag, the cubemaps are decoded without flip at the same time
+        stbi_set_flip_vertically_on_load_thread(true);
+        data = stbi_load(fileName.c_str(), &imWidth, &imHeight, &imNrChannels, 0);
+
+        if (!data){
+            std::cout << "Failed to Load texture" << std::endl;
+            const char* reason = stbi_failure_reason();
+            std::cout << reason << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    //create the OpenGL texture from the decoded image, must run on the OpenGL thread
+    bool upload(GLenum textureUnit){
+        std::lock_guard<std::mutex> lock(mutex);
+        if (textureObj)
+            return true;
+        if (!data && !cooked.isValid())
+            return false;
+
+        glGenTextures(1, &textureObj);
+        GLState::instance().bindTexture(textureUnit, GL_TEXTURE_2D, textureObj);
+
+        bool compressed = cooked.isValid();
+        if (compressed) {
+            uploadCookedTexture(GL_TEXTURE_2D, GL_TEXTURE_2D, cooked);
+        } else {
             switch (imNrChannels) {
             case 1:
                 glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, imWidth, imHeight, 0, GL_RED, GL_UNSIGNED_BYTE, data);
@@ -38,35 +94,129 @@ public:
             default:
                 std::cout << "Texture image number of channel not implemented" << std::endl;
             }
-            
-        }else {
-            std::cout << "Failed to Load texture" << std::endl;
-            const char* reason = stbi_failure_reason();
-            std::cout << reason << std::endl;
-            return false;
+            stbi_image_free(data);
+            data = NULL;
         }
-        stbi_image_free(data);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        if (!compressed)//the cooked file has the whole mip chain
+            glGenerateMipmap(GL_TEXTURE_2D);
 
         //unbind texture
-        glBindTexture(GL_TEXTURE_2D, 0);
+        GLState::instance().bindTexture(textureUnit, GL_TEXTURE_2D, 0);
         return true;
     }
 
+    //false until upload succeeded, textures can be loaded after the first frame
+    bool isLoaded() const {
+        return textureObj != 0;
+    }
+
     void bind(GLenum textureUnit){
-        glActiveTexture(textureUnit);
-        glBindTexture(GL_TEXTURE_2D, textureObj);
+        GLState::instance().bindTexture(textureUnit, GL_TEXTURE_2D, textureObj);
+    }
+
+    const std::string& getFileName() const {
+        return fileName;
     }
 
 private:
     std::string fileName;
-    GLuint textureObj;
+    GLuint textureObj = 0;
+    unsigned char* data = NULL;
+    int imWidth, imHeight, imNrChannels;
+    CookedTexture cooked;//used instead of data when the texture was cooked
+    std::mutex mutex;
 
 };
+
+/* Process wide cache sharing one Texture per image.
+Textures are found by resolved path first, then by content hash so copies of the same file are shared too.
+The cache only keeps weak references: the OpenGL texture is freed when the last material using it goes away.
+*/
+class TextureCache {
+public:
+    static TextureCache& instance(){
+        static TextureCache cache;
+        return cache;
+    }
+
+    //thread safe, does not decode the image
+    std::shared_ptr<Texture> acquire(const std::string& path){
+        std::string resolved = resolvePath(path);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<Texture> texture = byPath[resolved].lock();
+            if (texture) {
+                hits++;
+                return texture;
+            }
+        }
+
+        //hash outside of the lock, it reads the whole file
+        uint64_t hash = hashFile(resolved);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        //another thread may have added it in the meantime
+        std::shared_ptr<Texture> texture = byPath[resolved].lock();
+        if (!texture && hash != 0)
+            texture = byHash[hash].lock();
+        if (texture) {
+            hits++;
+        } else {
+            misses++;
+            texture = std::make_shared<Texture>(resolved);
+            if (hash != 0)
+                byHash[hash] = texture;
+        }
+        byPath[resolved] = texture;
+        return texture;
+    }
+
+    //number of textures still used by someone, a texture found by several paths or by hash is counted once
+    unsigned int liveTextures(){
+        std::lock_guard<std::mutex> lock(mutex);
+        std::set<Texture*> live;
+        for (auto& entry : byPath)
+            if (std::shared_ptr<Texture> texture = entry.second.lock())
+                live.insert(texture.get());
+        for (auto& entry : byHash)
+            if (std::shared_ptr<Texture> texture = entry.second.lock())
+                live.insert(texture.get());
+        return (unsigned int) live.size();
+    }
+
+    void printStats(){
+        unsigned int live = liveTextures();
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << "Texture cache: " << hits << " hits, " << misses << " misses, " << live << " textures alive" << std::endl;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, std::weak_ptr<Texture>> byPath;
+    std::map<uint64_t, std::weak_ptr<Texture>> byHash;
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+
+    TextureCache(){}
+
+    static std::string resolvePath(const std::string& path){
+#ifdef _WIN32
+        char* resolved = _fullpath(NULL, path.c_str(), 0);
+#else
+        char* resolved = realpath(path.c_str(), NULL);
+#endif
+        if (!resolved)//missing file, keep the path to report the error when decoding
+            return path;
+        std::string result(resolved);
+        free(resolved);
+        return result;
+    }
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,280 @@
+#ifndef TEXTURECOOK_H
+#define TEXTURECOOK_H
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "stb_image.h"
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+#include "meshcache.h"
+
+/* Cooked textures: mip chains compressed offline by --cook, uploaded with glCompressedTexImage2D instead of
+decoding the JPEG and generating the mipmaps at startup. The format follows the role of the texture in the material:
+    colors: BC1 (DXT1), or BC3 (DXT5) with alpha
+    normal maps: BC5 (RGTC2), x and y of the normal only, LIGHT.frag rebuilds z. The 5:6:5 endpoints of BC1 bend the normals
+    specular maps: BC4 (RGTC1), the exponent is read from the red channel
+
+Layout (one file per texture or per cubemap):
+    CookedTextureHeader
+    for every face (1, or 6 in the CUBEMAP_FACE_TARGETS order), for every level: uint32 size + blocks
+The images are stored already flipped the way the runtime loads them.
+*/
+#define COOKED_TEXTURE_MAGIC 0x58455443 //"CTEX"
+#define COOKED_TEXTURE_VERSION 2 //2: normal and specular maps in BC5 and BC4
+
+struct CookedTextureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;//hash of the source image(s), a stale cooked file is ignored
+    uint32_t format;//GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_COMPRESSED_RG_RGTC2 or GL_COMPRESSED_RED_RGTC1
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t faces;
+    uint32_t padding;
+};
+
+//a cooked file mapped in memory until it is uploaded
+struct CookedTexture {
+    std::unique_ptr<MappedFile> file;
+    CookedTextureHeader header;
+    std::vector<const unsigned char*> images;//faces * levels
+    std::vector<uint32_t> sizes;
+
+    bool isValid() const {
+        return file != nullptr;
+    }
+
+    void release(){
+        file.reset();
+        images.clear();
+        sizes.clear();
+    }
+};
+
+//what a texture holds, chooses the compression of the cooked file
+enum TextureRole {
+    TEXTURE_ROLE_COLOR,
+    TEXTURE_ROLE_NORMAL,
+    TEXTURE_ROLE_SPECULAR
+};
+
+//cooked files live next to the mesh cache: "name.jpg.ctex" for a texture, "cubemapFolder.ctex" for a cubemap
+std::string cookedTexturePath(std::string sourcePath){
+    while(!sourcePath.empty() && (sourcePath.back() == '/' || sourcePath.back() == '\\'))
+        sourcePath.pop_back();
+    std::string::size_type slashIndex = sourcePath.find_last_of("/\\") + 1;
+    return std::string(PATH_TO_CACHE "/") + sourcePath.substr(slashIndex) + ".ctex";
+}
+
+//BC1 and BC3 need S3TC, the RGTC formats are core since OpenGL 3.0
+bool canUseCookedFormat(uint32_t format){
+    if(format == GL_COMPRESSED_RG_RGTC2 || format == GL_COMPRESSED_RED_RGTC1)
+        return true;
+    return GLAD_GL_EXT_texture_compression_s3tc != 0;
+}
+
+//returns false when the file is missing, stale or corrupted, the caller then decodes the source image
+bool readCookedTexture(const std::string& cookedPath, uint64_t sourceHash, uint32_t faces, CookedTexture& cooked){
+    if(sourceHash == 0)
+        return false;
+
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    if(!file->open(cookedPath) || file->size() < sizeof(CookedTextureHeader))
+        return false;
+
+    const CookedTextureHeader* h = (const CookedTextureHeader*) file->data();
+    if(h->magic != COOKED_TEXTURE_MAGIC || h->version != COOKED_TEXTURE_VERSION
+        || h->sourceHash != sourceHash || h->faces != faces || !canUseCookedFormat(h->format))
+        return false;
+
+    size_t cursor = sizeof(CookedTextureHeader);
+    for(uint32_t i = 0; i < h->faces * h->levels; i++){
+        if(cursor + sizeof(uint32_t) > file->size())
+            return false;
+        uint32_t size = *(const uint32_t*)(file->data() + cursor);
+        cursor += sizeof(uint32_t);
+        if(cursor + size > file->size())
+            return false;
+        cooked.images.push_back(file->data() + cursor);
+        cooked.sizes.push_back(size);
+        cursor += (size + 3) & ~(size_t)3;
+    }
+    cooked.header = *h;
+    cooked.file = std::move(file);
+    return true;
+}
+
+//upload every level of every face to the bound texture, faces are firstTarget + i (GL_TEXTURE_2D or the cubemap faces)
+void uploadCookedTexture(GLenum bindTarget, GLenum firstTarget, CookedTexture& cooked){
+    const CookedTextureHeader& h = cooked.header;
+    for(uint32_t face = 0; face < h.faces; face++){
+        for(uint32_t level = 0; level < h.levels; level++){
+            int width = std::max(1u, h.width >> level);
+            int height = std::max(1u, h.height >> level);
+            unsigned int image = face * h.levels + level;
+            glCompressedTexImage2D(firstTarget + face, level, h.format, width, height, 0, cooked.sizes[image], cooked.images[image]);
+        }
+    }
+    glTexParameteri(bindTarget, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(bindTarget, GL_TEXTURE_MAX_LEVEL, h.levels - 1);
+    cooked.release();
+}
+
+//compressed format of a texture
+uint32_t cookedFormat(TextureRole role, bool alpha){
+    if(role == TEXTURE_ROLE_NORMAL)
+        return GL_COMPRESSED_RG_RGTC2;
+    if(role == TEXTURE_ROLE_SPECULAR)
+        return GL_COMPRESSED_RED_RGTC1;
+    return alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+//compress a RGBA image into 4x4 blocks of format, the border blocks are padded by repeating the last pixels
+std::vector<unsigned char> compressBlocks(const unsigned char* rgba, int width, int height, uint32_t format){
+    bool alpha = format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    int blockBytes = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    std::vector<unsigned char> blocks(blocksX * blocksY * blockBytes);
+
+    unsigned char block[64];
+    unsigned char channels[32];//red, or red and green, of the RGTC blocks
+    for(int by = 0; by < blocksY; by++){
+        for(int bx = 0; bx < blocksX; bx++){
+            for(int y = 0; y < 4; y++){
+                for(int x = 0; x < 4; x++){
+                    int px = std::min(bx * 4 + x, width - 1);
+                    int py = std::min(by * 4 + y, height - 1);
+                    memcpy(&block[(y * 4 + x) * 4], &rgba[(py * width + px) * 4], 4);
+                }
+            }
+            unsigned char* destination = &blocks[(by * blocksX + bx) * blockBytes];
+            if(format == GL_COMPRESSED_RED_RGTC1){
+                for(int i = 0; i < 16; i++)
+                    channels[i] = block[i * 4];
+                stb_compress_bc4_block(destination, channels);
+            }else if(format == GL_COMPRESSED_RG_RGTC2){
+                for(int i = 0; i < 16; i++){
+                    channels[i * 2] = block[i * 4];
+                    channels[i * 2 + 1] = block[i * 4 + 1];
+                }
+                stb_compress_bc5_block(destination, channels);
+            }else{
+                stb_compress_dxt_block(destination, block, alpha ? 1 : 0, STB_DXT_HIGHQUAL);
+            }
+        }
+    }
+    return blocks;
+}
+
+//the compressed mip chain of one face
+std::vector<std::vector<unsigned char>> compressMipChain(const unsigned char* rgba, int width, int height, uint32_t format){
+    std::vector<std::vector<unsigned char>> levels;
+    std::vector<unsigned char> current(rgba, rgba + width * height * 4);
+    while(true){
+        levels.push_back(compressBlocks(current.data(), width, height, format));
+        if(width == 1 && height == 1)
+            break;
+        int nextWidth = std::max(1, width / 2);
+        int nextHeight = std::max(1, height / 2);
+        std::vector<unsigned char> next(nextWidth * nextHeight * 4);
+        stbir_resize_uint8(current.data(), width, height, 0, next.data(), nextWidth, nextHeight, 0, 4);
+        current.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+    return levels;
+}
+
+//compress the images (1 texture or 6 cubemap faces of the same size) into cookedPath
+bool cookImages(const std::vector<std::string>& sources, const std::string& cookedPath, bool flipVertically,
+                TextureRole role = TEXTURE_ROLE_COLOR){
+    uint64_t sourceHash = 0xcbf29ce484222325ULL;
+    std::vector<std::vector<std::vector<unsigned char>>> faces;
+    int width = 0, height = 0;
+    uint32_t format = 0;
+
+    stbi_set_flip_vertically_on_load_thread(flipVertically);
+    for(const std::string& source : sources){
+        MappedFile file;
+        if(!file.open(source)){
+            std::cout << "Can not cook " << source << ": file not found" << std::endl;
+            return false;
+        }
+        sourceHash = hashBytes(file.data(), file.size(), sourceHash);
+
+        int w, h, channels;
+        unsigned char* rgba = stbi_load_from_memory(file.data(), file.size(), &w, &h, &channels, 4);
+        if(!rgba){
+            std::cout << "Can not cook " << source << ": " << stbi_failure_reason() << std::endl;
+            return false;
+        }
+        if(faces.empty()){
+            width = w;
+            height = h;
+            format = cookedFormat(role, channels == 2 || channels == 4);
+        }else if(w != width || h != height){
+            std::cout << "Can not cook " << source << ": faces have different sizes" << std::endl;
+            stbi_image_free(rgba);
+            return false;
+        }
+        faces.push_back(compressMipChain(rgba, w, h, format));
+        stbi_image_free(rgba);
+    }
+
+    CookedTextureHeader header = {};
+    header.magic = COOKED_TEXTURE_MAGIC;
+    header.version = COOKED_TEXTURE_VERSION;
+    header.sourceHash = sourceHash;
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.levels = faces[0].size();
+    header.faces = faces.size();
+
+    //same container writer as the mesh cache
+    MeshCacheWriter writer;
+    if(!writer.open(cookedPath, header))
+        return false;
+    size_t compressedBytes = 0;
+    for(auto& levels : faces){
+        for(auto& level : levels){
+            uint32_t size = level.size();
+            writer.write(&size, 1);
+            writer.write(level.data(), level.size());
+            compressedBytes += level.size();
+        }
+    }
+    if(!writer.close())
+        return false;
+
+    const char* formatName = format == GL_COMPRESSED_RG_RGTC2 ? " BC5, " : format == GL_COMPRESSED_RED_RGTC1 ? " BC4, "
+                           : format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? " BC3, " : " BC1, ";
+    std::cout << "Cooked " << cookedPath << ": " << width << "x" << height << formatName
+              << header.levels << " levels, " << compressedBytes << " bytes" << std::endl;
+    return true;
+}
+
+//hash of the source images, computed the same way as in cookImages
+uint64_t hashSourceImages(const std::vector<std::string>& sources){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(const std::string& source : sources){
+        MappedFile file;
+        if(!file.open(source))
+            return 0;
+        hash = hashBytes(file.data(), file.size(), hash);
+    }
+    return hash;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TIMESTEP_H
+#define TIMESTEP_H
+
+#include <cmath>
+#include <algorithm>
+
+/* Fixed timestep of the simulation, independent of the frame rate.
+Every frame adds its duration to an accumulator and the simulation runs as many steps of 1 / rate seconds as it
+holds, the rest is kept for the next frame. The frame is drawn between the two last states of the simulation,
+alpha() is the fraction of a step since the last one.
+When a frame lasts too long (a slow machine, a breakpoint, the window being moved) only SIMULATION_MAX_FRAME_TIME
+of it is simulated and the rest is dropped: when the steps cost more than the time they simulate, the game slows
+down instead of spending every frame catching up with more and more steps (spiral of death).
+*/
+#define SIMULATION_HZ 60.0 //default rate of the steps
+#define SIMULATION_TICK_RATE 60.0f //the speeds of the plane and of the controls are per tick, tuned at 60 frames per second
+#define SIMULATION_MAX_FRAME_TIME 0.1 //seconds simulated per frame at most
+
+class FixedTimestep {
+public:
+    FixedTimestep(double rate = SIMULATION_HZ) : step(1.0 / rate) {}
+
+    //add the duration of the frame, returns the number of steps to run
+    int advance(double frameTime){
+        frameTime = std::max(frameTime, 0.0);
+        if(frameTime > SIMULATION_MAX_FRAME_TIME){
+            dropped += frameTime - SIMULATION_MAX_FRAME_TIME;
+            frameTime = SIMULATION_MAX_FRAME_TIME;
+        }
+        accumulator += frameTime;
+        int steps = (int) std::floor(accumulator / step);
+        accumulator -= steps * step;
+        return steps;
+    }
+
+    //duration of a step in seconds
+    float stepTime() const {
+        return (float) step;
+    }
+
+    //between the previous state (0) and the last one (1)
+    float alpha() const {
+        return (float) (accumulator / step);
+    }
+
+    //seconds of simulation skipped by the guard since the start
+    double droppedTime() const {
+        return dropped;
+    }
+
+private:
+    double step;
+    double accumulator = 0.0;
+    double dropped = 0.0;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef UNIFORMBUFFERS_H
+#define UNIFORMBUFFERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "glstate.h"
+
+/* Uniforms shared by every program, filled once per frame in std140 uniform buffers.
+The shaders declare the same blocks:
+
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float timeOfDay;
+} frame;
+
+layout(std140) uniform LightData {
+    vec3 light_pos;
+    float ambient_strength;
+    float diffuse_strength;
+    float specular_strength;
+    float constant;
+    float linear;
+    float quadratic;
+} light;
+*/
+#define FRAME_DATA_BINDING 0
+#define LIGHT_DATA_BINDING 1
+
+struct FrameData {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec4 cameraPosition;//w unused
+    float timeOfDay;//sinus of the day cycle: positive during the day, negative at night
+    float padding[3];
+};
+
+//a vec3 followed by a float share the same 16 bytes in std140
+struct LightData {
+    glm::vec3 light_pos;
+    float ambient_strength;
+    float diffuse_strength;
+    float specular_strength;
+    //attenuation factors
+    float constant;
+    float linear;
+    float quadratic;
+    float padding[3];
+};
+
+static_assert(sizeof(FrameData) == 224, "FrameData must match the std140 layout");
+static_assert(sizeof(LightData) == 48, "LightData must match the std140 layout");
+
+//a uniform buffer holding one T, bound to a fixed binding point for the whole run
+template<typename T>
+class UniformBuffer {
+public:
+    UniformBuffer(GLuint binding){
+        glGenBuffers(1, &buffer);
+        GLState::instance().bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+        GLState::instance().bindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    ~UniformBuffer(){
+        glDeleteBuffers(1, &buffer);
+        GLState::instance().forgetBuffer(buffer);
+    }
+
+    void update(const T& data){
+        GLState::instance().bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    }
+
+private:
+    GLuint buffer = 0;
+};
+
+//connect the shared blocks used by the program to their binding points
+void bindSharedUniformBlocks(Shader& shader){
+    shader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+    shader.bindUniformBlock("LightData", LIGHT_DATA_BINDING);
+}
+
+#endif
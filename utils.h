@@ -3,50 +3,153 @@
 
 #include <glad/glad.h>
 #include <string>
+#include <future>
+#include <vector>
+#include <iostream>
+#include "texturecook.h"
+#include "glstate.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 
-void loadCubemapFace(const char * path, const GLenum& targetFace){
-    
-	int imWidth, imHeight, imNrChannels;
-	//Load the image using stbi_load
-	unsigned char* data = stbi_load(path, &imWidth, &imHeight, &imNrChannels, 0);
-	if (data){
-		glTexImage2D(targetFace, 0, GL_RGB, imWidth, imHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	}else {
-		std::cout << "Failed to Load texture" << std::endl;
-		const char* reason = stbi_failure_reason();
-		std::cout << (reason == NULL ? "Probably not implemented by the student" : reason) << std::endl;
+//the six decoded images of a cubemap, filled by decodeCubemapFaces and released by uploadCubemap
+struct CubemapFaces {
+    unsigned char* data[6] = {NULL};
+    int width[6], height[6], channels[6];
+    CookedTexture cooked;//used instead of data when the cubemap was cooked
+};
+
+const char* CUBEMAP_FACE_FILES[6] = {"posx.jpg", "negx.jpg", "posy.jpg", "negy.jpg", "posz.jpg", "negz.jpg"};
+//same order as CUBEMAP_FACE_FILES, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+const GLenum CUBEMAP_FACE_TARGETS[6] = {
+	GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
+	GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
+	GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
+};
+
+std::vector<std::string> cubemapFacePaths(const std::string& pathToCubeMap){
+	std::vector<std::string> paths;
+	for (int face = 0; face < 6; face++)
+		paths.push_back(pathToCubeMap + CUBEMAP_FACE_FILES[face]);
+	return paths;
+}
+
+//read the six images of the cubemap concurrently, does not need an OpenGL context
+//returns false if a face is missing or if the faces do not all have the same size and channels
+bool decodeCubemapFaces(const std::string& pathToCubeMap, CubemapFaces& faces){
+	//prefer the compressed faces made by --cook
+	if (readCookedTexture(cookedTexturePath(pathToCubeMap), hashSourceImages(cubemapFacePaths(pathToCubeMap)), 6, faces.cooked))
+		return true;
+
+	std::future<void> decoding[6];
+	for (int face = 0; face < 6; face++){
+		decoding[face] = std::async(std::launch::async, [&faces, &pathToCubeMap, face]{
+			stbi_set_flip_vertically_on_load_thread(false);
+			std::string path = pathToCubeMap + CUBEMAP_FACE_FILES[face];
+			//Load the image using stbi_load, grey faces are expanded to RGB and grey with alpha to RGBA to match the upload format
+			int fileChannels = 3;
+			if (stbi_info(path.c_str(), &faces.width[face], &faces.height[face], &fileChannels))
+				faces.channels[face] = fileChannels == 2 || fileChannels == 4 ? 4 : 3;
+			else
+				faces.channels[face] = 3;
+			faces.data[face] = stbi_load(path.c_str(), &faces.width[face], &faces.height[face], &fileChannels, faces.channels[face]);
+			if (!faces.data[face]){
+				const char* reason = stbi_failure_reason();
+				std::cout << "Failed to Load texture " << path << std::endl
+					<< (reason == NULL ? "Probably not implemented by the student" : reason) << std::endl;
+			}
+		});
+	}
+	for (int face = 0; face < 6; face++)
+		decoding[face].wait();
+
+	for (int face = 0; face < 6; face++){
+		if (!faces.data[face])
+			return false;
+		if (faces.width[face] != faces.height[face] || faces.width[face] != faces.width[0] || faces.channels[face] != faces.channels[0]){
+			std::cout << "Cubemap " << pathToCubeMap << ": face " << CUBEMAP_FACE_FILES[face] << " is " << faces.width[face] << "x" << faces.height[face]
+				<< " with " << faces.channels[face] << " channels, expected " << faces.width[0] << "x" << faces.width[0] << " with " << faces.channels[0] << std::endl;
+			return false;
+		}
 	}
-	stbi_image_free(data);	
+	return true;
 }
 
-void genCubemapTexture(GLuint * cubeMapTexture, std::string pathToCubeMap){
+void freeCubemapFaces(CubemapFaces& faces){
+	for (int face = 0; face < 6; face++){
+		stbi_image_free(faces.data[face]);
+		faces.data[face] = NULL;
+	}
+}
+
+//create the mipmapped cubemap texture from faces validated by decodeCubemapFaces and free them, on the OpenGL thread
+void uploadCubemap(GLuint * cubeMapTexture, CubemapFaces& faces){
+	int size = faces.width[0];
+	GLenum format = faces.channels[0] == 4 ? GL_RGBA : GL_RGB;
+	GLenum internalFormat = faces.channels[0] == 4 ? GL_RGBA8 : GL_RGB8;
+
     glGenTextures(1, cubeMapTexture);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, *cubeMapTexture);
+	GLState::instance().bindTexture(GL_TEXTURE0, GL_TEXTURE_CUBE_MAP, *cubeMapTexture);
 
 	// Set the texture parameters
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	
-    stbi_set_flip_vertically_on_load(false);
-	std::map<std::string, GLenum> facesToLoad = { 
-		{pathToCubeMap + "posx.jpg", GL_TEXTURE_CUBE_MAP_POSITIVE_X},
-		{pathToCubeMap + "posy.jpg", GL_TEXTURE_CUBE_MAP_POSITIVE_Y},
-		{pathToCubeMap + "posz.jpg", GL_TEXTURE_CUBE_MAP_POSITIVE_Z},
-		{pathToCubeMap + "negx.jpg", GL_TEXTURE_CUBE_MAP_NEGATIVE_X},
-		{pathToCubeMap + "negy.jpg", GL_TEXTURE_CUBE_MAP_NEGATIVE_Y},
-		{pathToCubeMap + "negz.jpg", GL_TEXTURE_CUBE_MAP_NEGATIVE_Z},
-	};
-	
-	for (std::pair<std::string, GLenum> pair : facesToLoad) 
-		loadCubemapFace(pair.first.c_str(), pair.second);
-	
+
+	if (faces.cooked.isValid()){
+		uploadCookedTexture(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X, faces.cooked);
+		return;
+	}
+
+	//immutable storage for the whole mip chain when available (OpenGL 4.2), the context only asks for 4.0
+	if (GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_storage){
+		int levels = 1;
+		while ((size >> levels) > 0)
+			levels++;
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, internalFormat, size, size);
+		for (int face = 0; face < 6; face++)
+			glTexSubImage2D(CUBEMAP_FACE_TARGETS[face], 0, 0, 0, size, size, format, GL_UNSIGNED_BYTE, faces.data[face]);
+	}else{
+		for (int face = 0; face < 6; face++)
+			glTexImage2D(CUBEMAP_FACE_TARGETS[face], 0, internalFormat, size, size, 0, format, GL_UNSIGNED_BYTE, faces.data[face]);
+	}
+	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	freeCubemapFaces(faces);
+}
+
+//compress the six faces into a single cooked file
+bool cookCubemap(const std::string& pathToCubeMap){
+	return cookImages(cubemapFacePaths(pathToCubeMap), cookedTexturePath(pathToCubeMap), false);
+}
+
+void genCubemapTexture(GLuint * cubeMapTexture, std::string pathToCubeMap){
+	CubemapFaces faces;
+	if (decodeCubemapFaces(pathToCubeMap, faces))
+		uploadCubemap(cubeMapTexture, faces);
+	else
+		freeCubemapFaces(faces);
+}
+
+//boot screen: a progress bar drawn with scissored clears, no shader needed
+void drawLoadingScreen(float progress, int width, int height){
+	int barWidth = width * 0.6;
+	int barHeight = height / 40 + 1;
+	int barX = (width - barWidth) / 2;
+	int barY = (height - barHeight) / 2;
+
+	glClearColor(0.08f, 0.0f, 0.06f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(barX, barY, barWidth, barHeight);
+	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glScissor(barX, barY, (int)(barWidth * progress), barHeight);
+	glClearColor(0.7f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
 }
 
 #endif
\ No newline at end of file
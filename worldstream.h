@@ -0,0 +1,394 @@
+#ifndef WORLDSTREAM_H
+#define WORLDSTREAM_H
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "object.h"
+#include "assetloader.h"
+#include "bvh.h"
+
+/* World streaming: a large object is cut into square tiles on the x/z plane of its object space,
+every tile is a mesh cache file loaded and evicted at run time depending on the plane position.
+
+Files written in PATH_TO_CACHE:
+    "name.tiles": TileIndexHeader then numTiles * TileIndexEntry
+    "name.tile_x_z.6.mesh": a mesh cache (see meshcache.h) of the triangles whose center is in the tile,
+        optimized and with LOD levels. Vertices on the tile borders are locked by the simplification,
+        so neighbour tiles with different levels do not crack.
+*/
+#define TILE_INDEX_MAGIC 0x4c495443 //"CTIL"
+#define TILE_INDEX_VERSION 2 //follows MESH_CACHE_VERSION, the tiles are cooked again when their format changes
+#define TILE_LOAD_OPTIONS (OBJECT_LOAD_OPTIMIZE | OBJECT_LOAD_LOD)
+
+#define WORLD_TILE_SIZE 250.0f
+#define WORLD_STREAM_RADIUS 2000.0f //tiles closer than this to the plane are loaded, the fog hides the others
+#define WORLD_PREFETCH_DISTANCE 1000.0f //tiles around this point ahead of the plane are loaded in the background
+#define WORLD_EVICT_HYSTERESIS 1.25f //a loaded tile is kept until it is this much farther than the radius
+#define WORLD_MEMORY_BUDGET (256u << 20) //bytes of mesh data kept loaded
+
+struct TileIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;
+    float tileSize;
+    uint32_t numTiles;
+};
+
+struct TileIndexEntry {
+    int32_t x;
+    int32_t z;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    uint32_t bytes;//size of the vertices and indices, counted in the memory budget
+    uint32_t padding;
+};
+
+std::string worldTileIndexPath(const std::string& sourcePath){
+    std::string::size_type slashIndex = sourcePath.find_last_of("/\\") + 1;
+    return std::string(PATH_TO_CACHE "/") + sourcePath.substr(slashIndex) + ".tiles";
+}
+
+//a tile is loaded like an Object from this path, meshCachePath turns it into "name.tile_x_z.6.mesh"
+std::string worldTilePath(const std::string& sourcePath, int x, int z){
+    return sourcePath + ".tile_" + std::to_string(x) + "_" + std::to_string(z);
+}
+
+//split the object into tiles and write them with their index, returns false if the source can not be loaded
+bool cookWorldTiles(const std::string& sourcePath, float tileSize){
+    uint64_t sourceHash = hashFile(sourcePath);
+    if(sourceHash == 0){
+        std::cout << "Can not cook tiles of " << sourcePath << ": file not found" << std::endl;
+        return false;
+    }
+    //only the tiles are read back, a cache of the whole source would never be used
+    Object source(sourcePath.c_str(), OBJECT_LOAD_NO_CACHE);
+    if(source.meshes.empty())
+        return false;
+
+    std::map<std::pair<int, int>, Object> tiles;
+    std::map<std::pair<int, int>, std::map<unsigned int, unsigned int>> tileMaterials;//source material -> tile material
+    std::vector<unsigned int> remap;
+    for(unsigned int meshIdx = 0; meshIdx < source.meshes.size(); meshIdx++){
+        const Object::BasicMeshEntry& mesh = source.meshes[meshIdx];
+
+        //triangles of this mesh in every tile
+        std::map<std::pair<int, int>, std::vector<unsigned int>> buckets;
+        for(unsigned int i = 0; i < mesh.numIndices; i += 3){
+            const unsigned int* triangle = &source.indices[mesh.baseIndex + i];
+            glm::vec3 center = (source.positions[mesh.baseVertex + triangle[0]] + source.positions[mesh.baseVertex + triangle[1]]
+                                + source.positions[mesh.baseVertex + triangle[2]]) / 3.0f;
+            std::pair<int, int> key((int) std::floor(center.x / tileSize), (int) std::floor(center.z / tileSize));
+            buckets[key].insert(buckets[key].end(), triangle, triangle + 3);
+        }
+
+        remap.assign(source.meshVertexCount(meshIdx), 0xFFFFFFFF);
+        for(auto& bucket : buckets){
+            Object& tile = tiles[bucket.first];
+            std::map<unsigned int, unsigned int>& materialRemap = tileMaterials[bucket.first];
+            if(!materialRemap.count(mesh.materialIndex)){
+                materialRemap[mesh.materialIndex] = tile.materialPaths.size();
+                tile.materialPaths.push_back(source.materialPaths[mesh.materialIndex]);
+            }
+
+            Object::BasicMeshEntry entry;
+            entry.baseVertex = tile.positions.size();
+            entry.baseIndex = tile.indices.size();
+            entry.numIndices = bucket.second.size();
+            entry.materialIndex = materialRemap[mesh.materialIndex];
+            for(unsigned int index : bucket.second){
+                if(remap[index] == 0xFFFFFFFF){
+                    unsigned int v = mesh.baseVertex + index;
+                    remap[index] = tile.positions.size() - entry.baseVertex;
+                    tile.positions.push_back(source.positions[v]);
+                    tile.normals.push_back(source.normals[v]);
+                    tile.tangents.push_back(source.tangents[v]);
+                    tile.textCoords.push_back(source.textCoords[v]);
+                }
+                tile.indices.push_back(remap[index]);
+            }
+            tile.meshes.push_back(entry);
+
+            //the remap is only valid inside this tile
+            for(unsigned int index : bucket.second)
+                remap[index] = 0xFFFFFFFF;
+        }
+    }
+
+    TileIndexHeader header = {};
+    header.magic = TILE_INDEX_MAGIC;
+    header.version = TILE_INDEX_VERSION;
+    header.sourceHash = sourceHash;
+    header.tileSize = tileSize;
+    header.numTiles = tiles.size();
+
+    std::vector<TileIndexEntry> entries;
+    for(auto& it : tiles){
+        Object& tile = it.second;
+        tile.path = worldTilePath(sourcePath, it.first.first, it.first.second);
+        tile.materials.resize(tile.materialPaths.size());
+        tile.optimizeMeshes();
+        tile.generateLods();
+        tile.computeBounds();
+        tile.saveToCache(tile.path.c_str(), sourceHash, TILE_LOAD_OPTIONS);
+
+        TileIndexEntry entry = {};
+        entry.x = it.first.first;
+        entry.z = it.first.second;
+        entry.boundsMin = entry.boundsMax = tile.positions[0];
+        for(const glm::vec3& position : tile.positions){
+            entry.boundsMin = glm::min(entry.boundsMin, position);
+            entry.boundsMax = glm::max(entry.boundsMax, position);
+        }
+        size_t vertexSize = sizeof(glm::vec3) * 3 + sizeof(glm::vec2);
+        entry.bytes = tile.positions.size() * vertexSize + tile.indices.size() * sizeof(unsigned int);
+        entries.push_back(entry);
+    }
+
+    //the index is written last, an interrupted cook is detected at the next start
+    MeshCacheWriter writer;
+    if(!writer.open(worldTileIndexPath(sourcePath), header))
+        return false;
+    writer.write(entries.data(), entries.size());
+    if(!writer.close())
+        return false;
+    std::cout << "Cooked " << tiles.size() << " tiles of " << sourcePath << std::endl;
+    return true;
+}
+
+//a tile of the streamed world, only used on the OpenGL thread (the workers only see its Object)
+struct WorldTile {
+    enum State {
+        TILE_UNLOADED,
+        TILE_LOADING,
+        TILE_RESIDENT,
+        TILE_MISSING//the tile file is stale or corrupted
+    };
+
+    TileIndexEntry entry;
+    std::string path;
+    std::shared_ptr<Object> object;
+    std::shared_ptr<TriangleBVH> collider;//in world space, only built when the streamer has a CollisionWorld
+    State state = TILE_UNLOADED;
+    float distance = 0;//priority of the last update, lower is more urgent
+};
+
+//returns false if the index is missing, stale or corrupted
+bool readWorldTileIndex(const std::string& sourcePath, uint64_t sourceHash, std::vector<WorldTile>& tiles){
+    MappedFile file;
+    if(sourceHash == 0 || !file.open(worldTileIndexPath(sourcePath)) || file.size() < sizeof(TileIndexHeader))
+        return false;
+    const TileIndexHeader* h = (const TileIndexHeader*) file.data();
+    if(h->magic != TILE_INDEX_MAGIC || h->version != TILE_INDEX_VERSION || h->sourceHash != sourceHash
+        || file.size() < sizeof(TileIndexHeader) + h->numTiles * sizeof(TileIndexEntry))
+        return false;
+
+    const TileIndexEntry* entries = (const TileIndexEntry*) (file.data() + sizeof(TileIndexHeader));
+    tiles.resize(h->numTiles);
+    for(unsigned int i = 0; i < h->numTiles; i++){
+        tiles[i].entry = entries[i];
+        tiles[i].path = worldTilePath(sourcePath, entries[i].x, entries[i].z);
+    }
+    return true;
+}
+
+/* Keeps the tiles around the plane loaded through the AssetLoader.
+The tiles within WORLD_STREAM_RADIUS are loaded with the priority given to update, the ones around the point
+WORLD_PREFETCH_DISTANCE ahead with the next priority. The closest tiles fill the memory budget first,
+the loaded tiles outside of it are evicted: the OpenGL buffers are deleted on the OpenGL thread
+and the CPU copy is freed on a worker.
+*/
+class WorldStreamer {
+public:
+    WorldStreamer(AssetLoader& loader, const std::string& sourcePath, Shader* shader, const glm::mat4& model,
+                  size_t memoryBudget = WORLD_MEMORY_BUDGET)
+        : loader(loader), sourcePath(sourcePath), shader(shader), model(model), inverseModel(glm::inverse(model)), memoryBudget(memoryBudget){
+    }
+
+    WorldStreamer(const WorldStreamer&) = delete;
+    WorldStreamer& operator=(const WorldStreamer&) = delete;
+
+    //the resident tiles are added to collisions, set it before open
+    void setCollisionWorld(CollisionWorld* collisions){
+        this->collisions = collisions;
+    }
+
+    //read the tile index on a worker, the tiles are cooked first if the index is missing or stale
+    void open(int priority){
+        std::string path = sourcePath;
+        std::shared_ptr<std::vector<WorldTile>> index = std::make_shared<std::vector<WorldTile>>();
+        std::shared_ptr<uint64_t> hash = std::make_shared<uint64_t>(0);
+        loader.load(priority,
+            [path, index, hash]{
+                *hash = hashFile(path);
+                if(!readWorldTileIndex(path, *hash, *index) && cookWorldTiles(path, WORLD_TILE_SIZE))
+                    readWorldTileIndex(path, *hash, *index);
+            },
+            [this, index, hash]{
+                for(WorldTile& tile : *index)
+                    tiles.push_back(std::make_shared<WorldTile>(tile));
+                sourceHash = *hash;
+                std::cout << "Streaming " << tiles.size() << " tiles of " << sourcePath << std::endl;
+            });
+    }
+
+    //queue the loads and evictions for this plane position, on the OpenGL thread
+    void update(const glm::vec3& position, const glm::vec3& front, int priority){
+        glm::vec3 localPosition = glm::vec3(inverseModel * glm::vec4(position, 1.0f));
+        glm::vec3 localFront = glm::vec3(inverseModel * glm::vec4(front, 0.0f));
+        if(glm::length(localFront) > 0.0f)
+            localFront = glm::normalize(localFront);
+        glm::vec3 prefetchPosition = localPosition + localFront * WORLD_PREFETCH_DISTANCE;
+
+        //the tiles needed now come first, then the prefetched ones
+        std::vector<std::shared_ptr<WorldTile>> wanted;
+        for(std::shared_ptr<WorldTile>& tile : tiles){
+            if(tile->state == WorldTile::TILE_MISSING)
+                continue;
+            float radius = tile->state == WorldTile::TILE_UNLOADED ? WORLD_STREAM_RADIUS : WORLD_STREAM_RADIUS * WORLD_EVICT_HYSTERESIS;
+            float distance = distanceToTile(*tile, localPosition);
+            float prefetchDistance = distanceToTile(*tile, prefetchPosition);
+            if(distance < radius)
+                tile->distance = distance;
+            else if(prefetchDistance < radius)
+                tile->distance = radius + prefetchDistance;
+            else
+                continue;
+            wanted.push_back(tile);
+        }
+        std::sort(wanted.begin(), wanted.end(), [](const std::shared_ptr<WorldTile>& a, const std::shared_ptr<WorldTile>& b){
+            return a->distance < b->distance;
+        });
+
+        size_t budgetBytes = 0;
+        std::set<WorldTile*> kept;
+        for(std::shared_ptr<WorldTile>& tile : wanted){
+            if(budgetBytes + tile->entry.bytes > memoryBudget)
+                break;
+            budgetBytes += tile->entry.bytes;
+            kept.insert(tile.get());
+            if(tile->state == WorldTile::TILE_UNLOADED)
+                loadTile(tile, tile->distance < WORLD_STREAM_RADIUS ? priority : priority + 1);
+        }
+
+        for(std::shared_ptr<WorldTile>& tile : tiles){
+            if(tile->state == WorldTile::TILE_RESIDENT && !kept.count(tile.get()))
+                evictTile(*tile);
+        }
+    }
+
+    //draw the loaded tiles in the view frustum, the model matrix given to the constructor must be set in the shader
+    void draw(const LodView& view){
+        Frustum frustum = makeFrustum(view.viewProjection * model);
+        for(std::shared_ptr<WorldTile>& tile : tiles){
+            if(tile->state != WorldTile::TILE_RESIDENT)
+                continue;
+            //a tile out of the screen or hidden skips the test of its meshes
+            if(!frustumContainsBox(frustum, tile->entry.boundsMin, tile->entry.boundsMax))
+                Object::cullCounters().culled += tile->object->meshes.size();
+            else if(view.occlusion && !view.occlusion->isVisible(view.viewProjection * model, tile->entry.boundsMin, tile->entry.boundsMax))
+                Object::cullCounters().occluded += tile->object->meshes.size();
+            else
+                tile->object->draw(model, view);
+        }
+    }
+
+    //queue the occluders of the loaded tiles in the view frustum
+    void addOccluders(OcclusionBuffer& occlusion, const LodView& view) const {
+        Frustum frustum = makeFrustum(view.viewProjection * model);
+        for(const std::shared_ptr<WorldTile>& tile : tiles){
+            if(tile->state == WorldTile::TILE_RESIDENT && frustumContainsBox(frustum, tile->entry.boundsMin, tile->entry.boundsMax))
+                tile->object->addOccluders(occlusion, model, view.cameraPosition);
+        }
+    }
+
+    //bytes of the loaded and loading tiles
+    size_t residentBytes() const {
+        size_t bytes = 0;
+        for(const std::shared_ptr<WorldTile>& tile : tiles){
+            if(tile->state == WorldTile::TILE_LOADING || tile->state == WorldTile::TILE_RESIDENT)
+                bytes += tile->entry.bytes;
+        }
+        return bytes;
+    }
+
+private:
+    AssetLoader& loader;
+    std::string sourcePath;
+    uint64_t sourceHash = 0;
+    Shader* shader;
+    glm::mat4 model;
+    glm::mat4 inverseModel;
+    size_t memoryBudget;
+    CollisionWorld* collisions = nullptr;
+    std::vector<std::shared_ptr<WorldTile>> tiles;
+
+    static float distanceToTile(const WorldTile& tile, const glm::vec3& position){
+        glm::vec3 closest = glm::clamp(position, tile.entry.boundsMin, tile.entry.boundsMax);
+        return glm::length(position - closest);
+    }
+
+    void loadTile(const std::shared_ptr<WorldTile>& tile, int priority){
+        std::shared_ptr<Object> object = std::make_shared<Object>();
+        std::shared_ptr<bool> loaded = std::make_shared<bool>(false);
+        std::shared_ptr<TriangleBVH> collider = collisions ? std::make_shared<TriangleBVH>() : nullptr;
+        std::string path = tile->path;
+        uint64_t hash = sourceHash;
+        glm::mat4 tileModel = model;
+        tile->object = object;
+        tile->state = WorldTile::TILE_LOADING;
+
+        AssetLoader* pLoader = &loader;
+        Shader* pShader = shader;
+        CollisionWorld* pCollisions = collisions;
+        loader.load(priority,
+            [object, loaded, path, hash, collider, tileModel]{
+                object->path = path;
+                object->packedMaterials = true;
+                *loaded = object->loadFromCache(path.c_str(), hash, TILE_LOAD_OPTIONS);
+                if(*loaded){
+                    object->createMaterials();
+                    if(collider)
+                        collider->build(*object, tileModel);
+                }
+            },
+            [tile, object, loaded, pLoader, pShader, collider, pCollisions]{
+                if(!*loaded){
+                    std::cout << "Can not load tile " << tile->path << ", cook the assets again" << std::endl;
+                    tile->object.reset();
+                    tile->state = WorldTile::TILE_MISSING;
+                    return;
+                }
+                object->makeBuffers(*pShader, VERTEX_FORMAT_PACKED);
+                loadMaterialsAsync(*pLoader, object.get(), PRIORITY_DETAIL);
+                if(pCollisions){
+                    tile->collider = collider;
+                    pCollisions->add(collider);
+                }
+                tile->state = WorldTile::TILE_RESIDENT;
+            });
+    }
+
+    void evictTile(WorldTile& tile){
+        std::shared_ptr<Object> object = std::move(tile.object);
+        std::shared_ptr<TriangleBVH> collider = std::move(tile.collider);
+        tile.state = WorldTile::TILE_UNLOADED;
+        if(collider)
+            collisions->remove(collider.get());
+        object->unload();
+        //the textures may be freed with the materials, they delete their OpenGL texture
+        object->materials.clear();
+        loader.load(PRIORITY_BACKGROUND, [object, collider]() mutable { object.reset(); collider.reset(); }, nullptr);
+    }
+};
+
+#endif